@@ -0,0 +1,22 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+TARGET = KMeansBenchmark
+
+SOURCES += \
+    main.cpp
+
+# Headless clustering library, built by Interactive-Kmeans.pro
+INCLUDEPATH += $$PWD/../KMeansEngine
+DEPENDPATH += $$PWD/../KMeansEngine
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../KMeansEngine/release/ -lKMeansEngine
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../KMeansEngine/debug/ -lKMeansEngine
+else:unix: LIBS += -L$$OUT_PWD/../KMeansEngine/ -lKMeansEngine -lpthread
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../KMeansEngine/release/libKMeansEngine.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../KMeansEngine/debug/libKMeansEngine.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../KMeansEngine/release/KMeansEngine.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../KMeansEngine/debug/KMeansEngine.lib
+else:unix: PRE_TARGETDEPS += $$OUT_PWD/../KMeansEngine/libKMeansEngine.a
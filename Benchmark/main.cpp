@@ -0,0 +1,413 @@
+// Timing sweep over the clustering engine for regression tracking. For
+// every N x D it times loading the same points from a text and a binary
+// file, then for every K x init mode x algorithm x point storage it times initialization,
+// single steps and a full run. Results go to stdout or --output as JSON
+// (default) or CSV, one record per measurement. --stream also times the
+// out-of-core StreamingKMeans over the binary file for every K x init mode.
+// --check instead runs the consistency checks and exits non-zero when one
+// fails.
+//
+// Usage: KMeansBenchmark [--n 10000,100000] [--d 2,3,10] [--k 8,64]
+//                        [--init 0,1,2] [--algorithm 0] [--storage 0] [--steps 10]
+//                        [--max-iterations 100] [--threads 0] [--seed 0]
+//                        [--format json|csv] [--output file] [--quick] [--stream] [--check]
+
+#include "BinaryFormat.h"
+#include "DistanceKernels.h"
+#include "KMeansEngine.h"
+#include "StreamingKMeans.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+  std::vector<int> counts = {10000, 100000, 1000000};
+  std::vector<int> dimensions = {2, 3, 10};
+  std::vector<int> clusters = {8, 64};
+  std::vector<int> initModes = {KMeansEngine::RandomReal, KMeansEngine::RandomSample, KMeansEngine::KMeansPlusPlus};
+  std::vector<int> algorithms = {KMeansEngine::Lloyd};
+  std::vector<int> storages = {KMeansEngine::Float32};
+  int steps = 10;
+  int maxIterations = 100;
+  int threads = 0;
+  // Engine seed, identical results for any --threads
+  unsigned long long seed = 0;
+  bool csv = false;
+  std::string output;
+  bool stream = false;
+  bool check = false;
+};
+
+struct Result
+{
+  std::string benchmark;
+  int n;
+  int d;
+  int k;
+  int init;
+  int algorithm;
+  int storage;
+  int iterations;
+  double seconds;
+  double energy;
+};
+
+const char *const InitNames[] = {"random_real", "random_sample", "kmeans++", "kmeans||"};
+const char *const AlgorithmNames[] = {"lloyd", "bound_pruned", "yinyang", "mini_batch", "kd_filter"};
+const char *const StorageNames[] = {"float32", "float16", "int8"};
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool parseList(const char *text, std::vector<int> &out)
+{
+  out.clear();
+  std::stringstream stream(text);
+  std::string item;
+  while(std::getline(stream, item, ',')){
+    char *end = nullptr;
+    long value = std::strtol(item.c_str(), &end, 10);
+    if(item.empty() || *end != '\0' || value < 0) return false;
+    out.push_back(int(value));
+  }
+  return !out.empty();
+}
+
+bool parseArguments(int argc, char **argv, Options &options)
+{
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+    if(arg == "--quick"){
+      options.counts = {10000};
+      options.dimensions = {2, 10};
+      options.clusters = {8};
+      continue;
+    }
+    if(arg == "--stream"){
+      options.stream = true;
+      continue;
+    }
+    if(arg == "--check"){
+      options.check = true;
+      continue;
+    }
+    if(!value) return false;
+    i++;
+    if(arg == "--n") ok = parseList(value, options.counts);
+    else if(arg == "--d") ok = parseList(value, options.dimensions);
+    else if(arg == "--k") ok = parseList(value, options.clusters);
+    else if(arg == "--init") ok = parseList(value, options.initModes);
+    else if(arg == "--algorithm") ok = parseList(value, options.algorithms);
+    else if(arg == "--storage") ok = parseList(value, options.storages);
+    else if(arg == "--steps") options.steps = std::atoi(value);
+    else if(arg == "--max-iterations") options.maxIterations = std::atoi(value);
+    else if(arg == "--threads") options.threads = std::atoi(value);
+    else if(arg == "--seed") options.seed = std::strtoull(value, nullptr, 10);
+    else if(arg == "--format") options.csv = std::strcmp(value, "csv") == 0;
+    else if(arg == "--output") options.output = value;
+    else ok = false;
+    if(!ok) return false;
+  }
+  for (int mode : options.initModes) {
+    if(mode > KMeansEngine::KMeansParallel) return false;
+  }
+  for (int algorithm : options.algorithms) {
+    if(algorithm > KMeansEngine::KdFilter) return false;
+  }
+  for (int storage : options.storages) {
+    if(storage > KMeansEngine::Int8) return false;
+  }
+  return true;
+}
+
+//Same distribution as KMeansEngine::generatePoints, but a fixed seed so
+//every run measures the same data
+std::vector<float> makePoints(int count, int dimension)
+{
+  std::mt19937 engine(12345);
+  std::uniform_real_distribution<float> distribution(-3.0f, 3.0f);
+  std::vector<float> points(std::size_t(count) * dimension);
+  for (float &value : points) value = distribution(engine);
+  return points;
+}
+
+bool writeText(const std::string &path, const std::vector<float> &points, int count, int dimension)
+{
+  std::FILE *file = BinaryFormat::openFile(path, "wb");
+  if(!file) return false;
+  std::fprintf(file, "%d\n%d\n", count, dimension);
+  for (int i = 0; i < count; i++) {
+    for (int d = 0; d < dimension; d++) {
+      std::fprintf(file, d + 1 < dimension ? "%.7g " : "%.7g\n", points[std::size_t(i) * dimension + d]);
+    }
+  }
+  return std::fclose(file) == 0;
+}
+
+//Full streamed runs over the binary file, each pass reads it from disk
+void benchmarkStream(const Options &options, const std::string &binaryPath, int n, int d, std::vector<Result> &results)
+{
+  const std::string labelPath = "kmeans_benchmark.labels";
+  for (int k : options.clusters) {
+    if(k < 2 || k > n) continue;
+    for (int init : options.initModes) {
+      StreamingKMeans streaming;
+      streaming.setThreadCount(options.threads);
+      streaming.setSeed(options.seed);
+      std::string error;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      if(!streaming.open(binaryPath, error) || !streaming.initialize(k, init, labelPath, error)){
+        std::fprintf(stderr, "Streaming: %s\n", error.c_str());
+        continue;
+      }
+      streaming.run(options.maxIterations);
+      if(!streaming.error().empty()) std::fprintf(stderr, "Streaming: %s\n", streaming.error().c_str());
+      Result result = {"stream_run", n, d, k, init, -1, -1, streaming.iteration(), secondsSince(start), streaming.energy()};
+      results.push_back(result);
+    }
+  }
+  std::remove(labelPath.c_str());
+}
+
+void benchmarkLoad(const Options &options, const std::vector<float> &points, int n, int d, std::vector<Result> &results)
+{
+  const std::string textPath = "kmeans_benchmark.txt";
+  const std::string binaryPath = "kmeans_benchmark.kmb";
+  std::string error;
+  if(!writeText(textPath, points, n, d) || !BinaryFormat::write(binaryPath, points.data(), n, d, nullptr, nullptr, error)){
+    std::fprintf(stderr, "Cannot write the load benchmark files\n");
+    return;
+  }
+  KMeansEngine engine;
+  engine.setThreadCount(options.threads);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(engine.loadTextFile(textPath, error)){
+    Result result = {"load_text", n, d, 0, -1, -1, -1, 0, secondsSince(start), 0.0};
+    results.push_back(result);
+  }
+  start = std::chrono::steady_clock::now();
+  if(engine.loadBinaryFile(binaryPath, error)){
+    //Mapped files are read lazily, touch every page so the read is timed
+    volatile float sum = 0.0f;
+    const float *data = engine.points();
+    for (std::size_t i = 0; i < std::size_t(n) * d; i += 1024) sum = sum + data[i];
+    Result result = {"load_binary", n, d, 0, -1, -1, -1, 0, secondsSince(start), 0.0};
+    results.push_back(result);
+  }
+  engine.clear();
+  if(options.stream) benchmarkStream(options, binaryPath, n, d, results);
+  std::remove(textPath.c_str());
+  std::remove(binaryPath.c_str());
+}
+
+void benchmarkClustering(const Options &options, const std::vector<float> &points, int n, int d, int k, int init,
+                         int algorithm, int storage, std::vector<Result> &results)
+{
+  KMeansEngine engine;
+  engine.setThreadCount(options.threads);
+  engine.setSeed(options.seed);
+  engine.setPoints(points.data(), n, d);
+  engine.setAlgorithm(algorithm);
+  engine.setStorage(storage);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(!engine.initialize(k, init)) return;
+  Result result = {"init", n, d, k, init, algorithm, storage, 0, secondsSince(start), 0.0};
+  //The compressed copy is built by the first step, keep it out of the step time
+  if(storage != KMeansEngine::Float32){
+    engine.step();
+    engine.initialize(k, init);
+  }
+  results.push_back(result);
+  //Mean over a fixed number of steps, the number to watch for step regressions
+  int steps = 0;
+  start = std::chrono::steady_clock::now();
+  while(steps < options.steps){
+    steps++;
+    if(!engine.step()) break;
+  }
+  result.benchmark = "step";
+  result.iterations = steps;
+  result.seconds = steps > 0 ? secondsSince(start) / steps : 0.0;
+  result.energy = engine.energy();
+  results.push_back(result);
+  engine.initialize(k, init);
+  start = std::chrono::steady_clock::now();
+  engine.run(options.maxIterations);
+  result.benchmark = "run";
+  result.iterations = engine.iteration();
+  result.seconds = secondsSince(start);
+  result.energy = engine.algorithm() == KMeansEngine::MiniBatch ? engine.fullEnergy() : engine.energy();
+  results.push_back(result);
+}
+
+//Stepping back after fullEnergy() must restore the labels the previous
+//step recorded, and stepping forward the relabeled ones
+bool checkHistory(const Options &options, const std::vector<float> &points, int n, int d, int k, int algorithm)
+{
+  const int steps = 6;
+  KMeansEngine engine;
+  engine.setThreadCount(options.threads);
+  engine.setSeed(options.seed);
+  engine.setPoints(points.data(), n, d);
+  engine.setAlgorithm(algorithm);
+  if(!engine.initialize(k, KMeansEngine::KMeansPlusPlus)) return true;
+  std::vector<std::vector<int> > recorded;
+  for (int s = 0; s < steps; s++) {
+    engine.step();
+    recorded.emplace_back(engine.labels(), engine.labels() + n);
+  }
+  engine.fullEnergy();
+  const std::vector<int> relabeled(engine.labels(), engine.labels() + n);
+  bool ok = engine.stepBack() && std::equal(recorded[steps - 2].begin(), recorded[steps - 2].end(), engine.labels());
+  ok = ok && engine.stepForward() && std::equal(relabeled.begin(), relabeled.end(), engine.labels());
+  if(!ok) std::fprintf(stderr, "History check failed: N=%d D=%d K=%d %s\n", n, d, k, AlgorithmNames[algorithm]);
+  return ok;
+}
+
+//With the whole file in one block and every point in the seeding sample,
+//the streamed run must reproduce KMeansEngine::run: same iterations,
+//centroids and labels (read back from the label file)
+bool checkStreaming(const Options &options, const std::vector<float> &points, int n, int d, int k)
+{
+  const std::string binaryPath = "kmeans_check.kmb";
+  const std::string labelPath = "kmeans_check.labels";
+  std::string error;
+  if(!BinaryFormat::write(binaryPath, points.data(), n, d, nullptr, nullptr, error)){
+    std::fprintf(stderr, "Streaming check: %s\n", error.c_str());
+    return false;
+  }
+  KMeansEngine engine;
+  engine.setThreadCount(options.threads);
+  engine.setSeed(options.seed);
+  engine.setPoints(points.data(), n, d);
+  engine.initialize(k, KMeansEngine::KMeansPlusPlus);
+  engine.run(options.maxIterations);
+  StreamingKMeans streaming;
+  streaming.setThreadCount(options.threads);
+  streaming.setSeed(options.seed);
+  streaming.setBlockBytes(points.size() * sizeof(float));
+  bool ok = streaming.open(binaryPath, error) && streaming.initialize(k, KMeansEngine::KMeansPlusPlus, labelPath, error);
+  if(ok){
+    streaming.run(options.maxIterations);
+    error = streaming.error();
+    ok = error.empty();
+  }
+  if(ok){
+    ok = streaming.iteration() == engine.iteration()
+        && std::equal(streaming.centroids().begin(), streaming.centroids().end(), engine.centroids());
+  }
+  if(ok){
+    //Labels are uint16 unless K needs more
+    std::FILE *file = BinaryFormat::openFile(labelPath, "rb");
+    const std::size_t width = streaming.wideLabels() ? sizeof(std::uint32_t) : sizeof(std::uint16_t);
+    std::vector<unsigned char> bytes(std::size_t(n) * width);
+    ok = file && std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    if(file) std::fclose(file);
+    for (int i = 0; ok && i < n; i++) {
+      const int label = width == sizeof(std::uint32_t) ? int(reinterpret_cast<const std::uint32_t *>(bytes.data())[i])
+                                                       : int(reinterpret_cast<const std::uint16_t *>(bytes.data())[i]);
+      ok = label == engine.labels()[i];
+    }
+  }
+  std::remove(binaryPath.c_str());
+  std::remove(labelPath.c_str());
+  if(!ok) std::fprintf(stderr, "Streaming check failed: N=%d D=%d K=%d %s\n", n, d, k, error.c_str());
+  return ok;
+}
+
+void writeResults(std::FILE *out, const Options &options, const std::vector<Result> &results, int threads)
+{
+  if(options.csv){
+    std::fprintf(out, "benchmark,n,d,k,init,algorithm,storage,iterations,seconds,energy\n");
+    for (const Result &r : results) {
+      std::fprintf(out, "%s,%d,%d,%d,%s,%s,%s,%d,%.9g,%.9g\n", r.benchmark.c_str(), r.n, r.d, r.k,
+                   r.init >= 0 ? InitNames[r.init] : "", r.algorithm >= 0 ? AlgorithmNames[r.algorithm] : "",
+                   r.storage >= 0 ? StorageNames[r.storage] : "", r.iterations, r.seconds, r.energy);
+    }
+    return;
+  }
+  std::fprintf(out, "{\n  \"isa\": \"%s\",\n  \"threads\": %d,\n  \"results\": [\n", DistanceKernels::isaName(), threads);
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    std::fprintf(out, "    {\"benchmark\": \"%s\", \"n\": %d, \"d\": %d, \"k\": %d, \"init\": \"%s\", \"algorithm\": \"%s\", "
+                      "\"storage\": \"%s\", \"iterations\": %d, \"seconds\": %.9g, \"energy\": %.9g}%s\n",
+                 r.benchmark.c_str(), r.n, r.d, r.k, r.init >= 0 ? InitNames[r.init] : "",
+                 r.algorithm >= 0 ? AlgorithmNames[r.algorithm] : "", r.storage >= 0 ? StorageNames[r.storage] : "",
+                 r.iterations, r.seconds, r.energy,
+                 i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(out, "  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if(!parseArguments(argc, argv, options)){
+    std::fprintf(stderr, "Usage: %s [--n list] [--d list] [--k list] [--init list] [--algorithm list] [--storage list]\n"
+                         "       [--steps n] [--max-iterations n] [--threads n] [--seed n] [--format json|csv]\n"
+                         "       [--output file] [--quick] [--stream] [--check]\n", argv[0]);
+    return 2;
+  }
+  if(options.check){
+    bool ok = true;
+    for (int n : options.counts) {
+      for (int d : options.dimensions) {
+        const std::vector<float> points = makePoints(n, d);
+        for (int k : options.clusters) {
+          if(k < 2 || k > n) continue;
+          for (int algorithm : {int(KMeansEngine::Lloyd), int(KMeansEngine::MiniBatch)}) {
+            ok = checkHistory(options, points, n, d, k, algorithm) && ok;
+          }
+          //Larger sets seed the streamed run from a subsample
+          if(n <= StreamingKMeans::MinSampleSize) ok = checkStreaming(options, points, n, d, k) && ok;
+        }
+      }
+    }
+    std::fprintf(stderr, ok ? "All checks passed\n" : "Checks failed\n");
+    return ok ? 0 : 1;
+  }
+  std::vector<Result> results;
+  for (int n : options.counts) {
+    for (int d : options.dimensions) {
+      const std::vector<float> points = makePoints(n, d);
+      std::fprintf(stderr, "N=%d D=%d\n", n, d);
+      benchmarkLoad(options, points, n, d, results);
+      for (int k : options.clusters) {
+        if(k < 2 || k > n) continue;
+        for (int init : options.initModes) {
+          for (int algorithm : options.algorithms) {
+            for (int storage : options.storages) {
+              benchmarkClustering(options, points, n, d, k, init, algorithm, storage, results);
+            }
+          }
+        }
+      }
+    }
+  }
+  std::FILE *out = options.output.empty() ? stdout : BinaryFormat::openFile(options.output, "wb");
+  if(!out){
+    std::fprintf(stderr, "Cannot open %s\n", options.output.c_str());
+    return 1;
+  }
+  KMeansEngine engine;
+  engine.setThreadCount(options.threads);
+  writeResults(out, options, results, engine.threadCount());
+  if(out != stdout) std::fclose(out);
+  return 0;
+}
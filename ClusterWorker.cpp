@@ -0,0 +1,113 @@
+#include "ClusterWorker.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+ClusterWorker::ClusterWorker(KMeansEngine *engine, QObject *parent)
+  : QThread(parent), m_engine(engine), m_converged(false), m_cancel(false), m_rate(0.0f)
+{
+}
+
+ClusterWorker::~ClusterWorker()
+{
+  stop();
+}
+
+void ClusterWorker::startSteps(int steps, int maxIterations)
+{
+  if(isRunning()) return;
+  m_task = Steps;
+  m_steps = steps;
+  m_maxIterations = maxIterations;
+  launch();
+}
+
+void ClusterWorker::startRestarts(int k, int mode, int restarts, int maxIterations)
+{
+  if(isRunning()) return;
+  m_task = Restarts;
+  m_restarts = restarts;
+  m_k = k;
+  m_mode = mode;
+  m_maxIterations = maxIterations;
+  launch();
+}
+
+void ClusterWorker::startSweep(int first, int last, int mode, int maxIterations)
+{
+  if(isRunning()) return;
+  m_task = Sweep;
+  m_k = first;
+  m_lastK = last;
+  m_mode = mode;
+  m_maxIterations = maxIterations;
+  launch();
+}
+
+void ClusterWorker::launch()
+{
+  m_converged = false;
+  m_cancel = false;
+  //Publish before starting so readers never see the engine mid-step
+  publish();
+  start();
+}
+
+void ClusterWorker::stop()
+{
+  m_cancel = true;
+  wait();
+}
+
+std::shared_ptr<const KMeansEngine::Snapshot> ClusterWorker::snapshot() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_snapshot;
+}
+
+void ClusterWorker::publish()
+{
+  std::shared_ptr<KMeansEngine::Snapshot> snapshot(new KMeansEngine::Snapshot());
+  m_engine->snapshot(*snapshot);
+  QMutexLocker locker(&m_mutex);
+  m_snapshot = snapshot;
+}
+
+void ClusterWorker::run()
+{
+  QElapsedTimer timer;
+  QElapsedTimer frame;
+  timer.start();
+  frame.start();
+  int done = 0;
+  if(m_task == Restarts){
+    m_converged = m_engine->runRestarts(m_k, m_mode, m_restarts, m_maxIterations, &m_cancel);
+    m_rate = float(m_engine->iteration() * 1000.0 / qMax<qint64>(1, timer.elapsed()));
+    publish();
+    emit progress();
+    return;
+  }
+  //The sweep leaves the engine's clustering alone, the snapshot stays valid
+  if(m_task == Sweep){
+    m_converged = m_engine->sweepK(m_k, m_lastK, m_mode, m_maxIterations, &m_cancel);
+    emit progress();
+    return;
+  }
+  while(!m_cancel && m_engine->iteration() < m_maxIterations){
+    bool moved = m_engine->step();
+    done++;
+    m_rate = float(done * 1000.0 / qMax<qint64>(1, timer.elapsed()));
+    if(!moved){
+      m_converged = true;
+      break;
+    }
+    if(m_steps > 0 && done >= m_steps) break;
+    //Copying the labels costs O(N), no point doing it faster than the screen
+    if(frame.elapsed() >= 16){
+      publish();
+      emit progress();
+      frame.restart();
+    }
+  }
+  publish();
+  emit progress();
+}
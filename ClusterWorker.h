@@ -0,0 +1,67 @@
+#ifndef CLUSTERWORKER_H
+#define CLUSTERWORKER_H
+
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include "KMeansEngine.h"
+
+// Steps a KMeansEngine on its own thread. While it runs the engine belongs
+// to the worker; the GUI only reads the immutable snapshots published after
+// each iteration (at most one per frame) and must stop() the worker before
+// touching the engine again.
+class ClusterWorker : public QThread
+{
+  Q_OBJECT
+
+public:
+  explicit ClusterWorker(KMeansEngine *engine, QObject *parent = nullptr);
+  ~ClusterWorker();
+
+  // steps = 0 runs until convergence or maxIterations
+  void startSteps(int steps, int maxIterations);
+  // KMeansEngine::runRestarts() on the worker thread
+  void startRestarts(int k, int mode, int restarts, int maxIterations);
+  // KMeansEngine::sweepK() on the worker thread
+  void startSweep(int first, int last, int mode, int maxIterations);
+  // Requests cancellation and waits for the current iteration to finish
+  void stop();
+  bool wasCancelled() const { return m_cancel.load(); }
+  bool converged() const { return m_converged.load(); }
+  float iterationsPerSecond() const { return m_rate.load(); }
+  std::shared_ptr<const KMeansEngine::Snapshot> snapshot() const;
+
+signals:
+  void progress();
+
+protected:
+  void run() override;
+
+private:
+  void publish();
+  void launch();
+
+  enum Task {
+    Steps,
+    Restarts,
+    Sweep
+  };
+
+  KMeansEngine *m_engine;
+  Task m_task = Steps;
+  int m_steps = 0;
+  int m_maxIterations = 0;
+  int m_restarts = 0;
+  int m_k = 0;
+  //Sweeps go from m_k to m_lastK
+  int m_lastK = 0;
+  int m_mode = 0;
+  std::atomic<bool> m_converged;
+  std::atomic<bool> m_cancel;
+  std::atomic<float> m_rate;
+  mutable QMutex m_mutex;
+  std::shared_ptr<const KMeansEngine::Snapshot> m_snapshot;
+};
+
+#endif // CLUSTERWORKER_H
@@ -12,6 +12,10 @@ ControlPanel::ControlPanel(QWidget *parent) :
   ui->axisCheckbox->setChecked(true);
   ui->pointsCheckbox->setChecked(true);
   ui->centroidsCheckbox->setChecked(true);
+#ifndef KMEANS_PROFILING
+  //Nothing is recorded without the profiling build
+  ui->traceB->hide();
+#endif
   connect(ui->initialB, &QPushButton::clicked, this, &ControlPanel::initialCentroids_clicked);
   connect(ui->stepB, &QPushButton::clicked, this, &ControlPanel::step_clicked);
   connect(ui->axisCheckbox, &QCheckBox::stateChanged, this, &ControlPanel::axisChecked);
@@ -79,6 +83,12 @@ void ControlPanel::zoomingChanged()
   emit zooming(ui->zoomingSlider->value());
 }
 
+//The run button stops the worker while it is busy
+void ControlPanel::setRunning(bool running)
+{
+  ui->runB->setText(running ? "Stop" : "Run Until End");
+}
+
 void ControlPanel::setSlider(QSlider *slider)
 {
   slider->setRange(0, 360 * 16);
@@ -106,6 +116,12 @@ void ControlPanel::on_fileLoadingB_clicked()
   emit loadingFileDir(file_name);
 }
 
+void ControlPanel::on_fileSavingB_clicked()
+{
+  QString file_name = QFileDialog::getSaveFileName(this,"Save Points", QDir::homePath(), "Point files (*.kmb)");
+  if(!file_name.isEmpty()) emit savingFileDir(file_name);
+}
+
 void ControlPanel::on_stepbackB_clicked()
 {
   emit stepBack();
@@ -140,3 +156,50 @@ void ControlPanel::on_freeViewCheckBox_clicked(bool checked)
 {
   emit freeView(checked);
 }
+
+void ControlPanel::on_algorithmComboBox_currentIndexChanged(int index)
+{
+  emit algorithm(index);
+}
+
+void ControlPanel::on_batchSizeSpinBox_valueChanged(int value)
+{
+  emit batchSize(value);
+}
+
+void ControlPanel::on_storageComboBox_currentIndexChanged(int index)
+{
+  emit storage(index);
+}
+
+void ControlPanel::on_refinementCheckBox_clicked(bool checked)
+{
+  emit exactRefinement(checked);
+}
+
+void ControlPanel::on_restartsSpinBox_valueChanged(int value)
+{
+  emit restarts(value);
+}
+
+void ControlPanel::on_seedSpinBox_valueChanged(int value)
+{
+  emit seed(value);
+}
+
+//Uses the initialization mode selected above
+void ControlPanel::on_sweepB_clicked()
+{
+  emit sweepK(ui->sweepFirstSpinBox->value(), ui->sweepLastSpinBox->value(), ui->comboBox->currentIndex());
+}
+
+void ControlPanel::on_fullEnergyB_clicked()
+{
+  emit fullEnergy();
+}
+
+void ControlPanel::on_traceB_clicked()
+{
+  QString file_name = QFileDialog::getSaveFileName(this,"Export Trace", QDir::homePath(), "Chrome trace (*.json)");
+  if(!file_name.isEmpty()) emit traceFileDir(file_name);
+}
@@ -28,9 +28,18 @@ public slots:
   void yRotationChanged();
   void zRotationChanged();
   void zoomingChanged();
+  void setRunning(bool running);
 
 signals:
   void initialCentroids(int K, int mode);
+  void restarts(int count);
+  void seed(int seed);
+  void sweepK(int first, int last, int mode);
+  void algorithm(int algorithm);
+  void batchSize(int size);
+  void storage(int storage);
+  void exactRefinement(bool on);
+  void fullEnergy();
   void step();
   void stepBack();
   void runThrough();
@@ -45,6 +54,8 @@ signals:
   void zooming(int distance);
   void randomSampling(int dimension, int sampleNumber);
   void loadingFileDir(QString dir);
+  void savingFileDir(QString dir);
+  void traceFileDir(QString dir);
   void pointSize(float size);
   void centroidSize(float size);
   void panningX(float d);
@@ -55,6 +66,8 @@ private slots:
 
   void on_fileLoadingB_clicked();
 
+  void on_fileSavingB_clicked();
+
   void on_stepbackB_clicked();
 
   void on_runB_clicked();
@@ -69,6 +82,24 @@ private slots:
 
   void on_freeViewCheckBox_clicked(bool checked);
 
+  void on_algorithmComboBox_currentIndexChanged(int index);
+
+  void on_batchSizeSpinBox_valueChanged(int value);
+
+  void on_storageComboBox_currentIndexChanged(int index);
+
+  void on_refinementCheckBox_clicked(bool checked);
+
+  void on_restartsSpinBox_valueChanged(int value);
+
+  void on_seedSpinBox_valueChanged(int value);
+
+  void on_sweepB_clicked();
+
+  void on_fullEnergyB_clicked();
+
+  void on_traceB_clicked();
+
 private:
   void setSlider(QSlider * slider);
   Ui::ControlPanel *ui;
@@ -3,18 +3,22 @@ QT       += core gui
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++11
+# qmake CONFIG+=profiling shows the phase timers and enables trace export
+profiling: DEFINES += KMEANS_PROFILING
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    ClusterWorker.cpp \
     ControlPanel.cpp \
     ViewWidget.cpp \
     main.cpp \
     MainWindow.cpp
 
 HEADERS += \
+    ClusterWorker.h \
     ControlPanel.h \
     MainWindow.h \
     ViewWidget.h
@@ -23,6 +27,20 @@ FORMS += \
     ControlPanel.ui \
     MainWindow.ui
 
+# Headless clustering library, built by Interactive-Kmeans.pro
+INCLUDEPATH += $$PWD/KMeansEngine
+DEPENDPATH += $$PWD/KMeansEngine
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/KMeansEngine/release/ -lKMeansEngine
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/KMeansEngine/debug/ -lKMeansEngine
+else:unix: LIBS += -L$$OUT_PWD/KMeansEngine/ -lKMeansEngine -lpthread
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/KMeansEngine/release/libKMeansEngine.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/KMeansEngine/debug/libKMeansEngine.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/KMeansEngine/release/KMeansEngine.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/KMeansEngine/debug/KMeansEngine.lib
+else:unix: PRE_TARGETDEPS += $$OUT_PWD/KMeansEngine/libKMeansEngine.a
+
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
@@ -0,0 +1,12 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    engine \
+    app \
+    benchmark
+
+engine.subdir = KMeansEngine
+app.file = Demo.pro
+app.depends = engine
+benchmark.subdir = Benchmark
+benchmark.depends = engine
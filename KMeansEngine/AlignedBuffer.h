@@ -0,0 +1,58 @@
+#ifndef ALIGNEDBUFFER_H
+#define ALIGNEDBUFFER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Allocator handing out cache-line aligned blocks so the point/centroid
+// buffers can be streamed with aligned vector loads.
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(std::size_t n)
+  {
+    if(n == 0) return nullptr;
+    void *ptr = nullptr;
+#if defined(_WIN32)
+    ptr = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+    if(posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) ptr = nullptr;
+#endif
+    if(!ptr) throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T *ptr, std::size_t)
+  {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <typename T>
+using AlignedBuffer = std::vector<T, AlignedAllocator<T>>;
+
+#endif // ALIGNEDBUFFER_H
@@ -0,0 +1,230 @@
+#include "BinaryFormat.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+namespace
+{
+
+const char NativeMagic[8] = {'K', 'M', 'P', 'O', 'I', 'N', 'T', 'S'};
+const char NpyMagic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+const std::size_t HeaderSize = 64;
+const std::size_t SectionAlignment = 64;
+
+template <typename T>
+T readValue(const char *data, std::size_t offset)
+{
+  T value;
+  std::memcpy(&value, data + offset, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void writeValue(char *data, std::size_t offset, T value)
+{
+  std::memcpy(data + offset, &value, sizeof(T));
+}
+
+std::size_t alignUp(std::size_t offset)
+{
+  return (offset + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+}
+
+// Whether count items of itemBytes each fit at offset, without forming a
+// product a crafted header could overflow
+bool fits(std::size_t offset, unsigned long long count, unsigned long long itemBytes, std::size_t size)
+{
+  return offset <= size && itemBytes > 0 && count <= (size - offset) / itemBytes;
+}
+
+// Value following 'key': in the header dict, or an empty string
+std::string npyField(const std::string &header, const char *key)
+{
+  std::size_t at = header.find(std::string("'") + key + "'");
+  if(at == std::string::npos) return std::string();
+  at = header.find(':', at);
+  if(at == std::string::npos) return std::string();
+  at = header.find_first_not_of(' ', at + 1);
+  if(at == std::string::npos) return std::string();
+  std::size_t stop;
+  if(header[at] == '\'') {
+    stop = header.find('\'', at + 1);
+    return stop == std::string::npos ? std::string() : header.substr(at + 1, stop - at - 1);
+  }
+  if(header[at] == '(') {
+    stop = header.find(')', at);
+    return stop == std::string::npos ? std::string() : header.substr(at + 1, stop - at - 1);
+  }
+  stop = header.find_first_of(",}", at);
+  return header.substr(at, stop == std::string::npos ? std::string::npos : stop - at);
+}
+
+} // namespace
+
+std::FILE *BinaryFormat::openFile(const std::string &path, const char *mode)
+{
+#if defined(_WIN32)
+  int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+  if(length <= 0) return nullptr;
+  std::vector<wchar_t> wide(length);
+  MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, wide.data(), length);
+  std::vector<wchar_t> wideMode(mode, mode + std::strlen(mode) + 1);
+  return _wfopen(wide.data(), wideMode.data());
+#else
+  return std::fopen(path.c_str(), mode);
+#endif
+}
+
+bool BinaryFormat::isNative(const char *data, std::size_t size)
+{
+  return size >= sizeof(NativeMagic) && std::memcmp(data, NativeMagic, sizeof(NativeMagic)) == 0;
+}
+
+bool BinaryFormat::isNpy(const char *data, std::size_t size)
+{
+  return size >= 10 && std::memcmp(data, NpyMagic, sizeof(NpyMagic)) == 0;
+}
+
+bool BinaryFormat::parseNative(const char *data, std::size_t size, Layout &layout, std::string &error)
+{
+  if(!isNative(data, size) || size < HeaderSize || readValue<std::uint32_t>(data, 8) != 1){
+    error = "Not a version 1 point file";
+    return false;
+  }
+  layout.dtype = int(readValue<std::uint32_t>(data, 12));
+  layout.count = (long long)readValue<std::uint64_t>(data, 16);
+  layout.dimension = int(readValue<std::uint32_t>(data, 24));
+  const std::uint32_t flags = readValue<std::uint32_t>(data, 28);
+  layout.fortranOrder = false;
+  layout.dataOffset = std::size_t(readValue<std::uint64_t>(data, 32));
+  layout.labelOffset = (flags & HasLabels) ? std::size_t(readValue<std::uint64_t>(data, 40)) : 0;
+  layout.weightOffset = (flags & HasWeights) ? std::size_t(readValue<std::uint64_t>(data, 48)) : 0;
+  if(layout.dtype != Float32){
+    error = "Unsupported value type";
+    return false;
+  }
+  const unsigned long long count = (unsigned long long)layout.count;
+  if(layout.count < 1 || layout.dimension < 1
+     || !fits(layout.dataOffset, count, (unsigned long long)layout.dimension * sizeof(float), size)
+     || (layout.labelOffset && !fits(layout.labelOffset, count, sizeof(std::int32_t), size))
+     || (layout.weightOffset && !fits(layout.weightOffset, count, sizeof(float), size))
+     || layout.dataOffset % sizeof(float) != 0 || layout.labelOffset % sizeof(std::int32_t) != 0
+     || layout.weightOffset % sizeof(float) != 0){
+    error = "Truncated or inconsistent point file";
+    return false;
+  }
+  return true;
+}
+
+bool BinaryFormat::parseNpy(const char *data, std::size_t size, Layout &layout, std::string &error)
+{
+  if(!isNpy(data, size)){
+    error = "Not a .npy file";
+    return false;
+  }
+  //Version 1 has a 16-bit header length, 2 and 3 a 32-bit one
+  const int major = (unsigned char)data[6];
+  if(major < 1 || major > 3){
+    error = "Unsupported .npy version " + std::to_string(major);
+    return false;
+  }
+  const std::size_t headerStart = major == 1 ? 10 : 12;
+  if(size < headerStart){
+    error = "Truncated .npy header";
+    return false;
+  }
+  const std::size_t headerLength = major == 1 ? readValue<std::uint16_t>(data, 8) : readValue<std::uint32_t>(data, 8);
+  if(headerStart + headerLength > size){
+    error = "Truncated .npy header";
+    return false;
+  }
+  const std::string header(data + headerStart, headerLength);
+  const std::string descr = npyField(header, "descr");
+  if(descr == "<f4" || descr == "|f4" || descr == "=f4"){
+    layout.dtype = Float32;
+  }else if(descr == "<f8" || descr == "=f8"){
+    layout.dtype = Float64;
+  }else{
+    error = "Unsupported .npy dtype '" + descr + "', expected little endian float32 or float64";
+    return false;
+  }
+  layout.fortranOrder = npyField(header, "fortran_order").find("True") != std::string::npos;
+  //Shape is "N," or "N, D"
+  const std::string shape = npyField(header, "shape");
+  long long dims[2] = {0, 1};
+  int rank = 0;
+  const char *p = shape.c_str();
+  while(*p){
+    char *next;
+    long long value = std::strtoll(p, &next, 10);
+    if(next == p){
+      p++;
+      continue;
+    }
+    if(rank == 2){
+      error = "Only 1-D and 2-D .npy arrays are supported";
+      return false;
+    }
+    dims[rank++] = value;
+    p = next;
+  }
+  layout.count = dims[0];
+  layout.dimension = int(dims[1]);
+  layout.dataOffset = headerStart + headerLength;
+  layout.labelOffset = 0;
+  layout.weightOffset = 0;
+  const std::size_t valueSize = layout.dtype == Float32 ? sizeof(float) : sizeof(double);
+  if(rank == 0 || layout.count < 1 || dims[1] < 1 || dims[1] > 0x7fffffff
+     || !fits(layout.dataOffset, (unsigned long long)layout.count, (unsigned long long)dims[1] * valueSize, size)){
+    error = "Empty or truncated .npy array";
+    return false;
+  }
+  return true;
+}
+
+bool BinaryFormat::write(const std::string &path, const float *points, int count, int dimension,
+                         const int *labels, const float *weights, std::string &error)
+{
+  const std::size_t dataBytes = std::size_t(count) * dimension * sizeof(float);
+  const std::size_t dataOffset = HeaderSize;
+  const std::size_t labelOffset = labels ? alignUp(dataOffset + dataBytes) : 0;
+  const std::size_t weightOffset = weights ? alignUp((labels ? labelOffset + count * sizeof(std::int32_t)
+                                                             : dataOffset + dataBytes)) : 0;
+  char header[HeaderSize] = {};
+  std::memcpy(header, NativeMagic, sizeof(NativeMagic));
+  writeValue<std::uint32_t>(header, 8, 1);
+  writeValue<std::uint32_t>(header, 12, Float32);
+  writeValue<std::uint64_t>(header, 16, std::uint64_t(count));
+  writeValue<std::uint32_t>(header, 24, std::uint32_t(dimension));
+  writeValue<std::uint32_t>(header, 28, (labels ? HasLabels : 0) | (weights ? HasWeights : 0));
+  writeValue<std::uint64_t>(header, 32, dataOffset);
+  writeValue<std::uint64_t>(header, 40, labelOffset);
+  writeValue<std::uint64_t>(header, 48, weightOffset);
+
+  std::FILE *file = openFile(path, "wb");
+  if(!file){
+    error = "Cannot write " + path;
+    return false;
+  }
+  std::size_t position = 0;
+  const char zeros[SectionAlignment] = {};
+  //Writes a section, zero padding up to its offset first
+  auto section = [&](std::size_t offset, const void *bytes, std::size_t length) {
+    bool ok = position == offset || std::fwrite(zeros, 1, offset - position, file) == offset - position;
+    ok = ok && std::fwrite(bytes, 1, length, file) == length;
+    position = offset + length;
+    return ok;
+  };
+  bool ok = section(0, header, HeaderSize) && section(dataOffset, points, dataBytes);
+  if(ok && labels) ok = section(labelOffset, labels, count * sizeof(std::int32_t));
+  if(ok && weights) ok = section(weightOffset, weights, count * sizeof(float));
+  ok = std::fclose(file) == 0 && ok;
+  if(!ok) error = "Writing " + path + " failed";
+  return ok;
+}
@@ -0,0 +1,60 @@
+#ifndef BINARYFORMAT_H
+#define BINARYFORMAT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// Binary point files that can be memory-mapped and used in place.
+//
+// Native format (little endian, 64-byte header):
+//   char     magic[8]      "KMPOINTS"
+//   uint32   version       1
+//   uint32   dtype         0 = float32
+//   uint64   count
+//   uint32   dimension
+//   uint32   flags         1 = int32 labels, 2 = float32 weights
+//   uint64   dataOffset    count x dimension values, row-major
+//   uint64   labelOffset   count labels, 0 when absent
+//   uint64   weightOffset  count weights, 0 when absent
+//   uint8    reserved[8]
+// Sections start on 64-byte boundaries so the mapped data stays aligned.
+//
+// NumPy .npy files with a 1-D or 2-D float32/float64 array are read too;
+// C-ordered float32 can be used in place, anything else has to be copied.
+namespace BinaryFormat
+{
+  enum DType {
+    Float32 = 0,
+    Float64 = 1
+  };
+
+  enum Flags {
+    HasLabels = 1,
+    HasWeights = 2
+  };
+
+  struct Layout
+  {
+    long long count = 0;
+    int dimension = 0;
+    int dtype = Float32;
+    bool fortranOrder = false;
+    std::size_t dataOffset = 0;
+    std::size_t labelOffset = 0;
+    std::size_t weightOffset = 0;
+  };
+
+  bool isNative(const char *data, std::size_t size);
+  bool isNpy(const char *data, std::size_t size);
+  // Both check that every section lies inside the file
+  bool parseNative(const char *data, std::size_t size, Layout &layout, std::string &error);
+  bool parseNpy(const char *data, std::size_t size, Layout &layout, std::string &error);
+
+  // fopen() taking a UTF-8 path on every platform
+  std::FILE *openFile(const std::string &path, const char *mode);
+  bool write(const std::string &path, const float *points, int count, int dimension,
+             const int *labels, const float *weights, std::string &error);
+}
+
+#endif // BINARYFORMAT_H
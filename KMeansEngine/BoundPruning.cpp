@@ -0,0 +1,427 @@
+#include "BoundPruning.h"
+#include "DistanceKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+// Elkan keeps k floats per point, above this Hamerly is used instead
+const double ElkanBoundBudget = 1024.0 * 1024.0 * 1024.0;
+const int HamerlyMaxK = 32;
+// Centroids per Yinyang group
+const int YinyangGroupSize = 10;
+// Elkan's k-long bound scan per point only pays off once a single distance
+// is expensive enough, below this Hamerly wins even for large k
+const int ElkanMinDimension = 128;
+// Bounds carry float rounding from many drift updates, a candidate is only
+// skipped when the bound wins by this relative margin. Anything closer is
+// evaluated with the same kernel as the Lloyd step.
+const float Slack = 1.0f + 1e-4f;
+}
+
+BoundPruning::Variant BoundPruning::chooseVariant(int pointCount, int dimension, int k)
+{
+  if(k <= HamerlyMaxK || dimension < ElkanMinDimension) return Hamerly;
+  if(double(pointCount) * k * sizeof(float) > ElkanBoundBudget) return Hamerly;
+  return Elkan;
+}
+
+void BoundPruning::assign(const Input &in, Variant variant, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials)
+{
+  if(variant != m_variant || in.pointCount != m_pointCount || in.k != m_k) m_valid = false;
+  m_variant = variant;
+  m_pointCount = in.pointCount;
+  m_k = in.k;
+  if(m_variant == Yinyang){
+    if(!m_valid) groupCentroids(in);
+    packGroups(in);
+  }else{
+    centerDistances(in, pool);
+  }
+  if(!m_valid){
+    fullPass(in, labels, pool, partials);
+    m_valid = true;
+  }else if(m_variant == Hamerly){
+    hamerlyPass(in, labels, pool, partials);
+  }else if(m_variant == Elkan){
+    elkanPass(in, labels, pool, partials);
+  }else{
+    yinyangPass(in, labels, pool, partials);
+  }
+}
+
+void BoundPruning::centerDistances(const Input &in, ThreadPool &pool)
+{
+  const int k = in.k;
+  m_halfNearest.assign(k, 0.0f);
+  if(m_variant == Elkan) m_halfCenter.resize(std::size_t(k) * k);
+  pool.parallelFor(0, k, [&](int begin, int end, int) {
+    std::vector<float> distances(in.stride);
+    for (int a = begin; a < end; a++) {
+      DistanceKernels::squaredDistances(in.centroids + std::size_t(a) * in.dimension, in.packed,
+                                        in.dimension, in.stride, distances.data());
+      float nearest = std::numeric_limits<float>::max();
+      for (int j = 0; j < k; j++) {
+        float half = 0.5f * std::sqrt(distances[j]);
+        if(m_variant == Elkan) m_halfCenter[std::size_t(a) * k + j] = half;
+        if(j != a && half < nearest) nearest = half;
+      }
+      m_halfNearest[a] = nearest;
+    }
+  });
+}
+
+namespace
+{
+// Exact argmin over one point using the same block kernel as the Lloyd step
+int nearest(const float *distances, int k, float &best, float &second)
+{
+  best = distances[0];
+  second = std::numeric_limits<float>::max();
+  int label = 0;
+  for (int j = 1; j < k; j++) {
+    if(distances[j] < best){
+      second = best;
+      best = distances[j];
+      label = j;
+    }else if(distances[j] < second){
+      second = distances[j];
+    }
+  }
+  return label;
+}
+}
+
+void BoundPruning::fullPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials)
+{
+  const int k = in.k;
+  const std::size_t boundsPerPoint = m_variant == Elkan ? k : m_variant == Yinyang ? m_groupCount : 1;
+  m_lower.resize(std::size_t(in.pointCount) * boundsPerPoint);
+  pool.parallelFor(0, in.pointCount, int(partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = partials[chunk];
+    acc.reset(k, in.dimension);
+    std::vector<float> distances(in.stride);
+    for (int i = begin; i < end; i++) {
+      const float *p = in.points + std::size_t(i) * in.dimension;
+      DistanceKernels::squaredDistances(p, in.packed, in.dimension, in.stride, distances.data());
+      float best, second;
+      int label = nearest(distances.data(), k, best, second);
+      float *lower = m_lower.data() + std::size_t(i) * boundsPerPoint;
+      if(m_variant == Elkan){
+        for (int j = 0; j < k; j++) lower[j] = std::sqrt(distances[j]);
+      }else if(m_variant == Yinyang){
+        for (int g = 0; g < m_groupCount; g++) {
+          float groupMin = std::numeric_limits<float>::max();
+          for (int m = m_groupStart[g]; m < m_groupStart[g + 1]; m++) {
+            const int j = m_groupMembers[m];
+            if(j != label && distances[j] < groupMin) groupMin = distances[j];
+          }
+          lower[g] = std::sqrt(groupMin);
+        }
+      }else{
+        lower[0] = std::sqrt(second);
+      }
+      labels[i] = label;
+      acc.add(p, in.dimension, label, std::sqrt(best));
+      acc.evaluations += k;
+    }
+  });
+}
+
+void BoundPruning::hamerlyPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials)
+{
+  const int k = in.k;
+  //Largest and second largest drift, the bound of a point whose own
+  //centroid moved the most only needs the second one
+  int maxIndex = 0;
+  float maxDrift = 0.0f, secondDrift = 0.0f;
+  for (int j = 0; j < k; j++) {
+    if(in.drift[j] > maxDrift){
+      secondDrift = maxDrift;
+      maxDrift = in.drift[j];
+      maxIndex = j;
+    }else if(in.drift[j] > secondDrift){
+      secondDrift = in.drift[j];
+    }
+  }
+  pool.parallelFor(0, in.pointCount, int(partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = partials[chunk];
+    acc.reset(k, in.dimension);
+    std::vector<float> distances(in.stride);
+    for (int i = begin; i < end; i++) {
+      const float *p = in.points + std::size_t(i) * in.dimension;
+      int label = labels[i];
+      float lower = m_lower[i] - (label == maxIndex ? secondDrift : maxDrift);
+      //Upper bound is kept tight so the energy stays exact
+      float upper = std::sqrt(DistanceKernels::squaredDistance(p, in.centroids + std::size_t(label) * in.dimension, in.dimension));
+      acc.evaluations++;
+      if(upper * Slack <= std::max(m_halfNearest[label], lower)){
+        m_lower[i] = lower;
+        acc.add(p, in.dimension, label, upper);
+        continue;
+      }
+      DistanceKernels::squaredDistances(p, in.packed, in.dimension, in.stride, distances.data());
+      acc.evaluations += k - 1;
+      float best, second;
+      label = nearest(distances.data(), k, best, second);
+      m_lower[i] = std::sqrt(second);
+      labels[i] = label;
+      acc.add(p, in.dimension, label, std::sqrt(best));
+    }
+  });
+}
+
+void BoundPruning::elkanPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials)
+{
+  const int k = in.k;
+  //Past this many single evaluations one block row is cheaper
+  const int rowThreshold = std::max(2, k / 8);
+  pool.parallelFor(0, in.pointCount, int(partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = partials[chunk];
+    acc.reset(k, in.dimension);
+    std::vector<float> distances(in.stride);
+    for (int i = begin; i < end; i++) {
+      const float *p = in.points + std::size_t(i) * in.dimension;
+      float *lower = m_lower.data() + std::size_t(i) * k;
+      for (int j = 0; j < k; j++) {
+        lower[j] = std::max(lower[j] - in.drift[j], 0.0f);
+      }
+      int label = labels[i];
+      float upperSq = DistanceKernels::squaredDistance(p, in.centroids + std::size_t(label) * in.dimension, in.dimension);
+      float upper = std::sqrt(upperSq);
+      acc.evaluations++;
+      lower[label] = upper;
+      if(upper * Slack <= m_halfNearest[label]){
+        acc.add(p, in.dimension, label, upper);
+        continue;
+      }
+      //Candidates closer than the slack to the best one are settled with
+      //the exact block row, so near ties resolve like the Lloyd argmin
+      bool exact = false;
+      int evaluated = 0;
+      for (int j = 0; j < k && !exact; j++) {
+        if(j == label) continue;
+        const float margin = upper * Slack;
+        if(margin <= lower[j] || margin <= m_halfCenter[std::size_t(label) * k + j]) continue;
+        if(++evaluated > rowThreshold){
+          exact = true;
+          break;
+        }
+        float distanceSq = DistanceKernels::squaredDistance(p, in.centroids + std::size_t(j) * in.dimension, in.dimension);
+        acc.evaluations++;
+        lower[j] = std::sqrt(distanceSq);
+        if(distanceSq * Slack * Slack >= upperSq && distanceSq <= upperSq * Slack * Slack) exact = true;
+        if(distanceSq < upperSq){
+          upperSq = distanceSq;
+          upper = lower[j];
+          label = j;
+        }
+      }
+      if(exact){
+        DistanceKernels::squaredDistances(p, in.packed, in.dimension, in.stride, distances.data());
+        acc.evaluations += k;
+        float best, second;
+        label = nearest(distances.data(), k, best, second);
+        for (int j = 0; j < k; j++) lower[j] = std::sqrt(distances[j]);
+        upper = lower[label];
+      }
+      labels[i] = label;
+      acc.add(p, in.dimension, label, upper);
+    }
+  });
+}
+
+// Groups the initial centroids with a few Lloyd iterations of their own,
+// seeded from evenly spaced centroids. Groups stay fixed afterwards.
+void BoundPruning::groupCentroids(const Input &in)
+{
+  const int k = in.k;
+  const int dimension = in.dimension;
+  int groups = std::max(1, k / YinyangGroupSize);
+  std::vector<float> seeds(std::size_t(groups) * dimension);
+  for (int g = 0; g < groups; g++) {
+    const float *c = in.centroids + std::size_t(g) * k / groups * dimension;
+    std::copy(c, c + dimension, seeds.begin() + std::size_t(g) * dimension);
+  }
+  m_groupOf.assign(k, 0);
+  std::vector<int> counts(groups);
+  for (int iteration = 0; iteration < 5; iteration++) {
+    for (int j = 0; j < k; j++) {
+      const float *c = in.centroids + std::size_t(j) * dimension;
+      float best = std::numeric_limits<float>::max();
+      for (int g = 0; g < groups; g++) {
+        float distance = DistanceKernels::squaredDistance(c, seeds.data() + std::size_t(g) * dimension, dimension);
+        if(distance < best){
+          best = distance;
+          m_groupOf[j] = g;
+        }
+      }
+    }
+    std::vector<double> sums(std::size_t(groups) * dimension, 0.0);
+    counts.assign(groups, 0);
+    for (int j = 0; j < k; j++) {
+      const float *c = in.centroids + std::size_t(j) * dimension;
+      for (int d = 0; d < dimension; d++) sums[std::size_t(m_groupOf[j]) * dimension + d] += c[d];
+      counts[m_groupOf[j]]++;
+    }
+    for (int g = 0; g < groups; g++) {
+      if(counts[g] == 0) continue;
+      for (int d = 0; d < dimension; d++) {
+        seeds[std::size_t(g) * dimension + d] = float(sums[std::size_t(g) * dimension + d] / counts[g]);
+      }
+    }
+  }
+  //Drop empty groups
+  std::vector<int> remap(groups, -1);
+  m_groupCount = 0;
+  for (int g = 0; g < groups; g++) {
+    if(counts[g] > 0) remap[g] = m_groupCount++;
+  }
+  m_groupStart.assign(m_groupCount + 1, 0);
+  for (int j = 0; j < k; j++) {
+    m_groupOf[j] = remap[m_groupOf[j]];
+    m_groupStart[m_groupOf[j] + 1]++;
+  }
+  for (int g = 0; g < m_groupCount; g++) m_groupStart[g + 1] += m_groupStart[g];
+  m_groupMembers.resize(k);
+  m_memberPos.resize(k);
+  std::vector<int> fill(m_groupStart.begin(), m_groupStart.end() - 1);
+  for (int j = 0; j < k; j++) {
+    m_memberPos[j] = fill[m_groupOf[j]] - m_groupStart[m_groupOf[j]];
+    m_groupMembers[fill[m_groupOf[j]]++] = j;
+  }
+  m_groupDrift.assign(m_groupCount, 0.0f);
+}
+
+// Transposed block per group, each starting on a cache line
+void BoundPruning::packGroups(const Input &in)
+{
+  const int dimension = in.dimension;
+  m_groupOffset.resize(m_groupCount);
+  m_groupStride.resize(m_groupCount);
+  std::size_t size = 0;
+  for (int g = 0; g < m_groupCount; g++) {
+    m_groupStride[g] = DistanceKernels::paddedStride(m_groupStart[g + 1] - m_groupStart[g]);
+    m_groupOffset[g] = size;
+    size += (std::size_t(m_groupStride[g]) * dimension + 15) / 16 * 16;
+  }
+  m_groupPacked.resize(size);
+  std::vector<float> members;
+  for (int g = 0; g < m_groupCount; g++) {
+    const int count = m_groupStart[g + 1] - m_groupStart[g];
+    members.resize(std::size_t(count) * dimension);
+    float drift = 0.0f;
+    for (int m = 0; m < count; m++) {
+      const int j = m_groupMembers[m_groupStart[g] + m];
+      const float *c = in.centroids + std::size_t(j) * dimension;
+      std::copy(c, c + dimension, members.begin() + std::size_t(m) * dimension);
+      drift = std::max(drift, in.drift[j]);
+    }
+    m_groupDrift[g] = drift;
+    DistanceKernels::pack(members.data(), count, dimension, m_groupStride[g], m_groupPacked.data() + m_groupOffset[g]);
+  }
+}
+
+void BoundPruning::yinyangPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials)
+{
+  const int k = in.k;
+  const int groups = m_groupCount;
+  int maxStride = 0;
+  for (int g = 0; g < groups; g++) maxStride = std::max(maxStride, m_groupStride[g]);
+  pool.parallelFor(0, in.pointCount, int(partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = partials[chunk];
+    acc.reset(k, in.dimension);
+    std::vector<float> distances(maxStride);
+    //Per examined group: nearest member and squared min/second min
+    std::vector<int> groupArg(groups);
+    std::vector<float> groupMin(groups);
+    std::vector<float> groupSecond(groups);
+    std::vector<char> examined(groups);
+    for (int i = begin; i < end; i++) {
+      const float *p = in.points + std::size_t(i) * in.dimension;
+      float *lower = m_lower.data() + std::size_t(i) * groups;
+      float globalLower = std::numeric_limits<float>::max();
+      for (int g = 0; g < groups; g++) {
+        lower[g] -= m_groupDrift[g];
+        globalLower = std::min(globalLower, lower[g]);
+      }
+      const int label = labels[i];
+      float labelSq = DistanceKernels::squaredDistance(p, in.centroids + std::size_t(label) * in.dimension, in.dimension);
+      acc.evaluations++;
+      if(std::sqrt(labelSq) * Slack <= globalLower){
+        acc.add(p, in.dimension, label, std::sqrt(labelSq));
+        continue;
+      }
+      //Examined groups are evaluated with the block kernel, so their
+      //distances match the Lloyd step bit for bit. The current label is
+      //only known exactly once its own group has been examined.
+      const int labelGroup = m_groupOf[label];
+      bool labelExact = false;
+      int other = -1;
+      float otherSq = std::numeric_limits<float>::max();
+      auto examine = [&](int g) {
+        const int first = m_groupStart[g];
+        const int count = m_groupStart[g + 1] - first;
+        DistanceKernels::squaredDistances(p, m_groupPacked.data() + m_groupOffset[g], in.dimension,
+                                          m_groupStride[g], distances.data());
+        acc.evaluations += count;
+        float min = distances[0], second = std::numeric_limits<float>::max();
+        int minPos = 0, secondPos = -1;
+        for (int m = 1; m < count; m++) {
+          const float distanceSq = distances[m];
+          if(distanceSq < min){
+            second = min;
+            secondPos = minPos;
+            min = distanceSq;
+            minPos = m;
+          }else if(distanceSq < second){
+            second = distanceSq;
+            secondPos = m;
+          }
+        }
+        groupArg[g] = m_groupMembers[first + minPos];
+        groupMin[g] = min;
+        groupSecond[g] = second;
+        examined[g] = 1;
+        //Best member other than the current label
+        float candidateSq = min;
+        int candidatePos = minPos;
+        if(g == labelGroup){
+          labelSq = distances[m_memberPos[label]];
+          labelExact = true;
+          if(groupArg[g] == label){
+            candidateSq = second;
+            candidatePos = secondPos;
+          }
+        }
+        if(candidatePos < 0) return;
+        const int candidate = m_groupMembers[first + candidatePos];
+        if(candidateSq < otherSq || (candidateSq == otherSq && candidate < other)){
+          otherSq = candidateSq;
+          other = candidate;
+        }
+      };
+      std::fill(examined.begin(), examined.end(), 0);
+      float upper = std::sqrt(labelSq);
+      for (int g = 0; g < groups; g++) {
+        if(upper * Slack <= lower[g]) continue;
+        examine(g);
+        upper = std::sqrt(std::min(labelSq, otherSq));
+      }
+      if(!labelExact && other >= 0 && otherSq <= labelSq * Slack * Slack) examine(labelGroup);
+      int newLabel = label;
+      if(other >= 0 && (otherSq < labelSq || (otherSq == labelSq && other < label))) newLabel = other;
+      //Examined groups take their exact min over members other than the
+      //new label, the old label's group also has to cover its distance
+      for (int g = 0; g < groups; g++) {
+        if(examined[g]) lower[g] = std::sqrt(groupArg[g] == newLabel ? groupSecond[g] : groupMin[g]);
+      }
+      if(newLabel != label && !examined[labelGroup]){
+        lower[labelGroup] = std::min(lower[labelGroup], std::sqrt(labelSq));
+      }
+      labels[i] = newLabel;
+      acc.add(p, in.dimension, newLabel, std::sqrt(newLabel == label ? labelSq : otherSq));
+    }
+  });
+}
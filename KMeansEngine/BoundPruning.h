@@ -0,0 +1,80 @@
+#ifndef BOUNDPRUNING_H
+#define BOUNDPRUNING_H
+
+#include "AlignedBuffer.h"
+#include "ChunkAccumulator.h"
+#include "ThreadPool.h"
+#include <vector>
+
+// Triangle-inequality pruned assignment (Hamerly 2010, Elkan 2003, Yinyang
+// by Ding et al. 2015).
+// Keeps per-point lower bounds across steps and uses the centroid drift of
+// the previous update to skip distance evaluations. Whenever a decision is
+// within float rounding of a tie the point falls back to the same block
+// kernel as the Lloyd step, so assignments match a plain Lloyd pass except
+// for exact ties, which go to the lowest centroid instead of a random one.
+class BoundPruning
+{
+public:
+  enum Variant {
+    Hamerly,
+    Elkan,
+    Yinyang
+  };
+
+  struct Input
+  {
+    const float *points;
+    int pointCount;
+    int dimension;
+    const float *centroids;
+    const float *packed;
+    int stride;
+    int k;
+    const float *drift;
+  };
+
+  // Bounds must be rebuilt whenever centroids change outside of a step
+  void invalidate() { m_valid = false; }
+  Variant variant() const { return m_variant; }
+  // Hamerly for small k or cheap distances, Elkan for moderate k in high dimension
+  static Variant chooseVariant(int pointCount, int dimension, int k);
+
+  // Assigns every point and accumulates it into partials[chunk], split
+  // into partials.size() chunks whatever the thread count
+  void assign(const Input &in, Variant variant, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials);
+
+private:
+  void centerDistances(const Input &in, ThreadPool &pool);
+  void fullPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials);
+  void hamerlyPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials);
+  void elkanPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials);
+  void groupCentroids(const Input &in);
+  void packGroups(const Input &in);
+  void yinyangPass(const Input &in, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials);
+
+  bool m_valid = false;
+  Variant m_variant = Hamerly;
+  int m_pointCount = 0;
+  int m_k = 0;
+  // Hamerly: one bound per point, Elkan: k bounds, Yinyang: one per group
+  AlignedBuffer<float> m_lower;
+  // Half the distance to the closest other centroid
+  std::vector<float> m_halfNearest;
+  // Elkan only: half centroid-centroid distances, k x k
+  std::vector<float> m_halfCenter;
+  // Yinyang only: centroids clustered into ~k/10 fixed groups, members of
+  // group g are m_groupMembers[m_groupStart[g] .. m_groupStart[g+1]) and are
+  // packed per group for the block kernel
+  int m_groupCount = 0;
+  std::vector<int> m_groupOf;
+  std::vector<int> m_groupStart;
+  std::vector<int> m_groupMembers;
+  std::vector<int> m_memberPos;
+  std::vector<std::size_t> m_groupOffset;
+  std::vector<int> m_groupStride;
+  std::vector<float> m_groupDrift;
+  AlignedBuffer<float> m_groupPacked;
+};
+
+#endif // BOUNDPRUNING_H
@@ -0,0 +1,71 @@
+#ifndef CHUNKACCUMULATOR_H
+#define CHUNKACCUMULATOR_H
+
+#include <cstddef>
+#include <vector>
+
+// Per-thread partial centroid sums, counts and energy filled by the
+// assignment kernels and reduced once per step.
+struct ChunkAccumulator
+{
+  std::vector<double> sums;
+  std::vector<long long> counts;
+  double energy = 0.0;
+  long long evaluations = 0;
+  // Points reassigned from their exact coordinates (quantized storage)
+  long long refined = 0;
+  bool active = false;
+
+  void reset(int k, int dimension)
+  {
+    sums.assign(std::size_t(k) * dimension, 0.0);
+    counts.assign(k, 0);
+    energy = 0.0;
+    evaluations = 0;
+    refined = 0;
+    active = true;
+  }
+
+  void add(const float *point, int dimension, int label, float distance)
+  {
+    double *s = sums.data() + std::size_t(label) * dimension;
+    for (int k = 0; k < dimension; k++) {
+      s[k] += point[k];
+    }
+    counts[label]++;
+    energy += distance;
+  }
+
+  // Sparse point, size nonzeros at the given columns
+  void addSparse(const int *columns, const float *values, int size, int dimension, int label, float distance)
+  {
+    double *s = sums.data() + std::size_t(label) * dimension;
+    for (int n = 0; n < size; n++) {
+      s[columns[n]] += values[n];
+    }
+    counts[label]++;
+    energy += distance;
+  }
+
+  // count points with the given coordinate sum and total distance at once
+  void addGroup(const double *sum, int dimension, int label, long long count, double distance)
+  {
+    double *s = sums.data() + std::size_t(label) * dimension;
+    for (int k = 0; k < dimension; k++) {
+      s[k] += sum[k];
+    }
+    counts[label] += count;
+    energy += distance;
+  }
+
+  void merge(const ChunkAccumulator &other)
+  {
+    for (std::size_t i = 0; i < sums.size(); i++) sums[i] += other.sums[i];
+    for (std::size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+    energy += other.energy;
+    evaluations += other.evaluations;
+    refined += other.refined;
+  }
+};
+
+#endif // CHUNKACCUMULATOR_H
@@ -0,0 +1,86 @@
+#ifndef COUNTERRNG_H
+#define COUNTERRNG_H
+
+#include <cstdint>
+
+// Counter-based generator (Philox4x32-10, Salmon et al. 2011). A block of
+// four 32-bit words is a pure function of a 64-bit key and a 128-bit
+// counter, so a draw keyed by (stream, point index, iteration) is the same
+// whichever thread makes it and in whatever order. As a
+// UniformRandomBitGenerator it walks the counter of one stream and can feed
+// the std distributions; a stream is either walked or keyed, never both.
+class CounterRng
+{
+public:
+  typedef std::uint32_t result_type;
+
+  struct Block
+  {
+    std::uint32_t v[4];
+  };
+
+  explicit CounterRng(std::uint64_t key = 0, std::uint32_t stream = 0) { seed(key, stream); }
+
+  void seed(std::uint64_t key, std::uint32_t stream = 0)
+  {
+    m_key = key;
+    m_stream = stream;
+    m_counter = 0;
+    m_used = 4;
+  }
+  std::uint64_t key() const { return m_key; }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return 0xffffffffu; }
+
+  result_type operator()()
+  {
+    if(m_used == 4){
+      m_block = block(m_key, std::uint32_t(m_counter), std::uint32_t(m_counter >> 32), 0, m_stream);
+      m_counter++;
+      m_used = 0;
+    }
+    return m_block.v[m_used++];
+  }
+
+  std::uint64_t next64()
+  {
+    const std::uint64_t high = (*this)();
+    return high << 32 | (*this)();
+  }
+
+  static Block block(std::uint64_t key, std::uint32_t c0, std::uint32_t c1, std::uint32_t c2, std::uint32_t c3)
+  {
+    Block x = {{c0, c1, c2, c3}};
+    std::uint32_t k0 = std::uint32_t(key);
+    std::uint32_t k1 = std::uint32_t(key >> 32);
+    for (int round = 0; round < 10; round++) {
+      const std::uint64_t p0 = std::uint64_t(0xD2511F53u) * x.v[0];
+      const std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * x.v[2];
+      const Block y = {{std::uint32_t(p1 >> 32) ^ x.v[1] ^ k0, std::uint32_t(p1),
+                        std::uint32_t(p0 >> 32) ^ x.v[3] ^ k1, std::uint32_t(p0)}};
+      x = y;
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    return x;
+  }
+
+  // Uniform in [0, 1) from 53 bits of the block at (index, a, b, stream)
+  static double uniform(std::uint64_t key, std::uint32_t stream, std::uint32_t index,
+                        std::uint32_t a = 0, std::uint32_t b = 0)
+  {
+    const Block x = block(key, index, a, b, stream);
+    const std::uint64_t bits = std::uint64_t(x.v[0]) << 21 | x.v[1] >> 11;
+    return double(bits) * (1.0 / 9007199254740992.0);
+  }
+
+private:
+  std::uint64_t m_key = 0;
+  std::uint64_t m_counter = 0;
+  std::uint32_t m_stream = 0;
+  int m_used = 4;
+  Block m_block;
+};
+
+#endif // COUNTERRNG_H
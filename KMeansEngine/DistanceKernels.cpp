@@ -0,0 +1,568 @@
+#include "DistanceKernels.h"
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KMEANS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define KMEANS_TARGET(isa)
+#else
+#define KMEANS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace
+{
+
+typedef void (*BlockKernel)(const float *, const float *, int, int, float *);
+typedef void (*SparseKernel)(const int *, const float *, int, float, const float *, const float *, int, float *);
+
+float halfToFloat(std::uint16_t half)
+{
+  const std::uint32_t sign = std::uint32_t(half & 0x8000) << 16;
+  int exponent = (half >> 10) & 0x1f;
+  std::uint32_t mantissa = half & 0x3ff;
+  std::uint32_t bits;
+  if(exponent == 0x1f){
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  }else if(exponent != 0){
+    bits = sign | (std::uint32_t(exponent + 112) << 23) | (mantissa << 13);
+  }else if(mantissa == 0){
+    bits = sign;
+  }else{
+    //Subnormal half, normalize it
+    exponent = 113;
+    while(!(mantissa & 0x400)){
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | (std::uint32_t(exponent) << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+float pairScalar(const float *a, const float *b, int dimension)
+{
+  float distance = 0.0f;
+  for (int i = 0; i < dimension; i++) {
+    float d = a[i] - b[i];
+    distance += d * d;
+  }
+  return distance;
+}
+
+void blockScalar(const float *point, const float *packed, int dimension, int stride, float *out)
+{
+  for (int j = 0; j < stride; j++) out[j] = 0.0f;
+  for (int d = 0; d < dimension; d++) {
+    const float p = point[d];
+    const float *row = packed + std::size_t(d) * stride;
+    for (int j = 0; j < stride; j++) {
+      float diff = p - row[j];
+      out[j] += diff * diff;
+    }
+  }
+}
+
+// Dot products with every centroid first, one packed row per nonzero
+void sparseScalar(const int *columns, const float *values, int count, float norm,
+                  const float *packed, const float *norms, int stride, float *out)
+{
+  for (int j = 0; j < stride; j++) out[j] = 0.0f;
+  for (int n = 0; n < count; n++) {
+    const float v = values[n];
+    const float *row = packed + std::size_t(columns[n]) * stride;
+    for (int j = 0; j < stride; j++) out[j] += v * row[j];
+  }
+  for (int j = 0; j < stride; j++) {
+    const float distance = norm + norms[j] - 2.0f * out[j];
+    out[j] = distance > 0.0f ? distance : 0.0f;
+  }
+}
+
+#ifdef KMEANS_X86
+// Four independent accumulators per pass so the adds/FMAs pipeline
+void blockSSE2(const float *point, const float *packed, int dimension, int stride, float *out)
+{
+  int j = 0;
+  for (; j + 16 <= stride; j += 16) {
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+    for (int d = 0; d < dimension; d++) {
+      const __m128 p = _mm_set1_ps(point[d]);
+      const float *row = packed + std::size_t(d) * stride + j;
+      __m128 d0 = _mm_sub_ps(p, _mm_load_ps(row));
+      __m128 d1 = _mm_sub_ps(p, _mm_load_ps(row + 4));
+      __m128 d2 = _mm_sub_ps(p, _mm_load_ps(row + 8));
+      __m128 d3 = _mm_sub_ps(p, _mm_load_ps(row + 12));
+      a0 = _mm_add_ps(a0, _mm_mul_ps(d0, d0));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(d1, d1));
+      a2 = _mm_add_ps(a2, _mm_mul_ps(d2, d2));
+      a3 = _mm_add_ps(a3, _mm_mul_ps(d3, d3));
+    }
+    _mm_storeu_ps(out + j, a0);
+    _mm_storeu_ps(out + j + 4, a1);
+    _mm_storeu_ps(out + j + 8, a2);
+    _mm_storeu_ps(out + j + 12, a3);
+  }
+  for (; j < stride; j += 4) {
+    __m128 a = _mm_setzero_ps();
+    for (int d = 0; d < dimension; d++) {
+      __m128 diff = _mm_sub_ps(_mm_set1_ps(point[d]), _mm_load_ps(packed + std::size_t(d) * stride + j));
+      a = _mm_add_ps(a, _mm_mul_ps(diff, diff));
+    }
+    _mm_storeu_ps(out + j, a);
+  }
+}
+
+void sparseSSE2(const int *columns, const float *values, int count, float norm,
+                const float *packed, const float *norms, int stride, float *out)
+{
+  const __m128 base = _mm_set1_ps(norm);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 zero = _mm_setzero_ps();
+  int j = 0;
+  for (; j + 16 <= stride; j += 16) {
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+    for (int n = 0; n < count; n++) {
+      const __m128 v = _mm_set1_ps(values[n]);
+      const float *row = packed + std::size_t(columns[n]) * stride + j;
+      a0 = _mm_add_ps(a0, _mm_mul_ps(v, _mm_load_ps(row)));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(v, _mm_load_ps(row + 4)));
+      a2 = _mm_add_ps(a2, _mm_mul_ps(v, _mm_load_ps(row + 8)));
+      a3 = _mm_add_ps(a3, _mm_mul_ps(v, _mm_load_ps(row + 12)));
+    }
+    _mm_storeu_ps(out + j, _mm_max_ps(zero, _mm_sub_ps(_mm_add_ps(base, _mm_loadu_ps(norms + j)), _mm_mul_ps(two, a0))));
+    _mm_storeu_ps(out + j + 4, _mm_max_ps(zero, _mm_sub_ps(_mm_add_ps(base, _mm_loadu_ps(norms + j + 4)), _mm_mul_ps(two, a1))));
+    _mm_storeu_ps(out + j + 8, _mm_max_ps(zero, _mm_sub_ps(_mm_add_ps(base, _mm_loadu_ps(norms + j + 8)), _mm_mul_ps(two, a2))));
+    _mm_storeu_ps(out + j + 12, _mm_max_ps(zero, _mm_sub_ps(_mm_add_ps(base, _mm_loadu_ps(norms + j + 12)), _mm_mul_ps(two, a3))));
+  }
+  for (; j < stride; j += 4) {
+    __m128 a = _mm_setzero_ps();
+    for (int n = 0; n < count; n++) {
+      a = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(values[n]), _mm_load_ps(packed + std::size_t(columns[n]) * stride + j)));
+    }
+    _mm_storeu_ps(out + j, _mm_max_ps(zero, _mm_sub_ps(_mm_add_ps(base, _mm_loadu_ps(norms + j)), _mm_mul_ps(two, a))));
+  }
+}
+
+// SSE2 is enough here, the loop is bound by loads rather than lanes
+float minSSE2(const float *values, int count)
+{
+  int j = 0;
+  float min = values[0];
+  if(count >= 16){
+    __m128 m0 = _mm_loadu_ps(values), m1 = m0, m2 = m0, m3 = m0;
+    for (; j + 16 <= count; j += 16) {
+      m0 = _mm_min_ps(m0, _mm_loadu_ps(values + j));
+      m1 = _mm_min_ps(m1, _mm_loadu_ps(values + j + 4));
+      m2 = _mm_min_ps(m2, _mm_loadu_ps(values + j + 8));
+      m3 = _mm_min_ps(m3, _mm_loadu_ps(values + j + 12));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, _mm_min_ps(_mm_min_ps(m0, m1), _mm_min_ps(m2, m3)));
+    for (int i = 0; i < 4; i++) min = lanes[i] < min ? lanes[i] : min;
+  }
+  for (; j < count; j++) min = values[j] < min ? values[j] : min;
+  return min;
+}
+
+// Single pair kernels vectorize across the dimension instead
+float pairSSE2(const float *a, const float *b, int dimension)
+{
+  __m128 acc = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 4 <= dimension; i += 4) {
+    __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+  }
+  __m128 shuf = _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1));
+  __m128 sums = _mm_add_ps(acc, shuf);
+  shuf = _mm_movehl_ps(shuf, sums);
+  float distance = _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+  for (; i < dimension; i++) {
+    float d = a[i] - b[i];
+    distance += d * d;
+  }
+  return distance;
+}
+
+KMEANS_TARGET("avx2,fma")
+float pairAVX2(const float *a, const float *b, int dimension)
+{
+  __m256 acc = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= dimension; i += 8) {
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    acc = _mm256_fmadd_ps(d, d, acc);
+  }
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+  float distance = _mm_cvtss_f32(half);
+  for (; i < dimension; i++) {
+    float d = a[i] - b[i];
+    distance += d * d;
+  }
+  return distance;
+}
+
+KMEANS_TARGET("avx512f")
+float pairAVX512(const float *a, const float *b, int dimension)
+{
+  __m512 acc = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= dimension; i += 16) {
+    __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    acc = _mm512_fmadd_ps(d, d, acc);
+  }
+  if(i < dimension){
+    const __mmask16 mask = __mmask16((1u << (dimension - i)) - 1);
+    __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+    acc = _mm512_fmadd_ps(d, d, acc);
+  }
+  alignas(64) float lanes[16];
+  _mm512_store_ps(lanes, acc);
+  for (int step = 8; step > 0; step /= 2) {
+    for (int l = 0; l < step; l++) lanes[l] += lanes[l + step];
+  }
+  return lanes[0];
+}
+
+KMEANS_TARGET("avx2,fma")
+void blockAVX2(const float *point, const float *packed, int dimension, int stride, float *out)
+{
+  int j = 0;
+  for (; j + 32 <= stride; j += 32) {
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+    for (int d = 0; d < dimension; d++) {
+      const __m256 p = _mm256_set1_ps(point[d]);
+      const float *row = packed + std::size_t(d) * stride + j;
+      __m256 d0 = _mm256_sub_ps(p, _mm256_load_ps(row));
+      __m256 d1 = _mm256_sub_ps(p, _mm256_load_ps(row + 8));
+      __m256 d2 = _mm256_sub_ps(p, _mm256_load_ps(row + 16));
+      __m256 d3 = _mm256_sub_ps(p, _mm256_load_ps(row + 24));
+      a0 = _mm256_fmadd_ps(d0, d0, a0);
+      a1 = _mm256_fmadd_ps(d1, d1, a1);
+      a2 = _mm256_fmadd_ps(d2, d2, a2);
+      a3 = _mm256_fmadd_ps(d3, d3, a3);
+    }
+    _mm256_storeu_ps(out + j, a0);
+    _mm256_storeu_ps(out + j + 8, a1);
+    _mm256_storeu_ps(out + j + 16, a2);
+    _mm256_storeu_ps(out + j + 24, a3);
+  }
+  for (; j < stride; j += 8) {
+    __m256 a = _mm256_setzero_ps();
+    for (int d = 0; d < dimension; d++) {
+      __m256 diff = _mm256_sub_ps(_mm256_set1_ps(point[d]), _mm256_load_ps(packed + std::size_t(d) * stride + j));
+      a = _mm256_fmadd_ps(diff, diff, a);
+    }
+    _mm256_storeu_ps(out + j, a);
+  }
+}
+
+KMEANS_TARGET("avx512f")
+void blockAVX512(const float *point, const float *packed, int dimension, int stride, float *out)
+{
+  int j = 0;
+  for (; j + 64 <= stride; j += 64) {
+    __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+    for (int d = 0; d < dimension; d++) {
+      const __m512 p = _mm512_set1_ps(point[d]);
+      const float *row = packed + std::size_t(d) * stride + j;
+      __m512 d0 = _mm512_sub_ps(p, _mm512_load_ps(row));
+      __m512 d1 = _mm512_sub_ps(p, _mm512_load_ps(row + 16));
+      __m512 d2 = _mm512_sub_ps(p, _mm512_load_ps(row + 32));
+      __m512 d3 = _mm512_sub_ps(p, _mm512_load_ps(row + 48));
+      a0 = _mm512_fmadd_ps(d0, d0, a0);
+      a1 = _mm512_fmadd_ps(d1, d1, a1);
+      a2 = _mm512_fmadd_ps(d2, d2, a2);
+      a3 = _mm512_fmadd_ps(d3, d3, a3);
+    }
+    _mm512_storeu_ps(out + j, a0);
+    _mm512_storeu_ps(out + j + 16, a1);
+    _mm512_storeu_ps(out + j + 32, a2);
+    _mm512_storeu_ps(out + j + 48, a3);
+  }
+  for (; j < stride; j += 16) {
+    __m512 a = _mm512_setzero_ps();
+    for (int d = 0; d < dimension; d++) {
+      __m512 diff = _mm512_sub_ps(_mm512_set1_ps(point[d]), _mm512_load_ps(packed + std::size_t(d) * stride + j));
+      a = _mm512_fmadd_ps(diff, diff, a);
+    }
+    _mm512_storeu_ps(out + j, a);
+  }
+}
+
+KMEANS_TARGET("avx2,fma")
+void sparseAVX2(const int *columns, const float *values, int count, float norm,
+                const float *packed, const float *norms, int stride, float *out)
+{
+  const __m256 base = _mm256_set1_ps(norm);
+  const __m256 minusTwo = _mm256_set1_ps(-2.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  int j = 0;
+  for (; j + 32 <= stride; j += 32) {
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+    for (int n = 0; n < count; n++) {
+      const __m256 v = _mm256_set1_ps(values[n]);
+      const float *row = packed + std::size_t(columns[n]) * stride + j;
+      a0 = _mm256_fmadd_ps(v, _mm256_load_ps(row), a0);
+      a1 = _mm256_fmadd_ps(v, _mm256_load_ps(row + 8), a1);
+      a2 = _mm256_fmadd_ps(v, _mm256_load_ps(row + 16), a2);
+      a3 = _mm256_fmadd_ps(v, _mm256_load_ps(row + 24), a3);
+    }
+    _mm256_storeu_ps(out + j, _mm256_max_ps(zero, _mm256_fmadd_ps(minusTwo, a0, _mm256_add_ps(base, _mm256_loadu_ps(norms + j)))));
+    _mm256_storeu_ps(out + j + 8, _mm256_max_ps(zero, _mm256_fmadd_ps(minusTwo, a1, _mm256_add_ps(base, _mm256_loadu_ps(norms + j + 8)))));
+    _mm256_storeu_ps(out + j + 16, _mm256_max_ps(zero, _mm256_fmadd_ps(minusTwo, a2, _mm256_add_ps(base, _mm256_loadu_ps(norms + j + 16)))));
+    _mm256_storeu_ps(out + j + 24, _mm256_max_ps(zero, _mm256_fmadd_ps(minusTwo, a3, _mm256_add_ps(base, _mm256_loadu_ps(norms + j + 24)))));
+  }
+  for (; j < stride; j += 8) {
+    __m256 a = _mm256_setzero_ps();
+    for (int n = 0; n < count; n++) {
+      a = _mm256_fmadd_ps(_mm256_set1_ps(values[n]), _mm256_load_ps(packed + std::size_t(columns[n]) * stride + j), a);
+    }
+    _mm256_storeu_ps(out + j, _mm256_max_ps(zero, _mm256_fmadd_ps(minusTwo, a, _mm256_add_ps(base, _mm256_loadu_ps(norms + j)))));
+  }
+}
+
+// max(x, 0) through the zero-masked form: GCC 12 flags the undefined
+// pass-through of plain _mm512_max_ps with -Wmaybe-uninitialized
+KMEANS_TARGET("avx512f")
+inline __m512 clampZeroAVX512(__m512 x)
+{
+  return _mm512_maskz_max_ps(__mmask16(0xFFFF), x, _mm512_setzero_ps());
+}
+
+KMEANS_TARGET("avx512f")
+void sparseAVX512(const int *columns, const float *values, int count, float norm,
+                  const float *packed, const float *norms, int stride, float *out)
+{
+  const __m512 base = _mm512_set1_ps(norm);
+  const __m512 minusTwo = _mm512_set1_ps(-2.0f);
+  int j = 0;
+  for (; j + 64 <= stride; j += 64) {
+    __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+    for (int n = 0; n < count; n++) {
+      const __m512 v = _mm512_set1_ps(values[n]);
+      const float *row = packed + std::size_t(columns[n]) * stride + j;
+      a0 = _mm512_fmadd_ps(v, _mm512_load_ps(row), a0);
+      a1 = _mm512_fmadd_ps(v, _mm512_load_ps(row + 16), a1);
+      a2 = _mm512_fmadd_ps(v, _mm512_load_ps(row + 32), a2);
+      a3 = _mm512_fmadd_ps(v, _mm512_load_ps(row + 48), a3);
+    }
+    _mm512_storeu_ps(out + j, clampZeroAVX512(_mm512_fmadd_ps(minusTwo, a0, _mm512_add_ps(base, _mm512_loadu_ps(norms + j)))));
+    _mm512_storeu_ps(out + j + 16, clampZeroAVX512(_mm512_fmadd_ps(minusTwo, a1, _mm512_add_ps(base, _mm512_loadu_ps(norms + j + 16)))));
+    _mm512_storeu_ps(out + j + 32, clampZeroAVX512(_mm512_fmadd_ps(minusTwo, a2, _mm512_add_ps(base, _mm512_loadu_ps(norms + j + 32)))));
+    _mm512_storeu_ps(out + j + 48, clampZeroAVX512(_mm512_fmadd_ps(minusTwo, a3, _mm512_add_ps(base, _mm512_loadu_ps(norms + j + 48)))));
+  }
+  for (; j < stride; j += 16) {
+    __m512 a = _mm512_setzero_ps();
+    for (int n = 0; n < count; n++) {
+      a = _mm512_fmadd_ps(_mm512_set1_ps(values[n]), _mm512_load_ps(packed + std::size_t(columns[n]) * stride + j), a);
+    }
+    _mm512_storeu_ps(out + j, clampZeroAVX512(_mm512_fmadd_ps(minusTwo, a, _mm512_add_ps(base, _mm512_loadu_ps(norms + j)))));
+  }
+}
+
+KMEANS_TARGET("avx2,f16c")
+void decodeHalfAVX2(const std::uint16_t *in, int count, float *out)
+{
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))));
+  }
+  for (; i < count; i++) out[i] = halfToFloat(in[i]);
+}
+
+KMEANS_TARGET("avx2,fma")
+void decodeInt8AVX2(const std::int8_t *in, const float *scale, const float *offset, int count, float *out)
+{
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 q = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i))));
+    _mm256_storeu_ps(out + i, _mm256_fmadd_ps(q, _mm256_loadu_ps(scale + i), _mm256_loadu_ps(offset + i)));
+  }
+  for (; i < count; i++) out[i] = offset[i] + scale[i] * in[i];
+}
+
+DistanceKernels::Isa detectIsa()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  const int maxLeaf = info[0];
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool fma = (info[2] & (1 << 12)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+  unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+  bool avx2 = false, avx512 = false;
+  if(maxLeaf >= 7){
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+    avx512 = (info[1] & (1 << 16)) != 0;
+  }
+  if(avx512 && (xcr0 & 0xE6) == 0xE6) return DistanceKernels::AVX512;
+  if(avx && avx2 && fma && (xcr0 & 0x6) == 0x6) return DistanceKernels::AVX2;
+  return DistanceKernels::SSE2;
+#else
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) return DistanceKernels::AVX512;
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return DistanceKernels::AVX2;
+  if(__builtin_cpu_supports("sse2")) return DistanceKernels::SSE2;
+  return DistanceKernels::Scalar;
+#endif
+}
+
+// F16C is a separate CPUID bit, the half decoder checks it on its own
+bool detectF16c()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 29)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("f16c");
+#endif
+}
+
+const bool s_f16c = detectF16c();
+#else
+DistanceKernels::Isa detectIsa()
+{
+  return DistanceKernels::Scalar;
+}
+#endif
+
+const DistanceKernels::Isa s_supported = detectIsa();
+std::atomic<int> s_isa(s_supported);
+
+BlockKernel blockKernel(DistanceKernels::Isa isa)
+{
+  switch (isa) {
+#ifdef KMEANS_X86
+  case DistanceKernels::AVX512: return blockAVX512;
+  case DistanceKernels::AVX2: return blockAVX2;
+  case DistanceKernels::SSE2: return blockSSE2;
+#endif
+  default: return blockScalar;
+  }
+}
+
+SparseKernel sparseKernel(DistanceKernels::Isa isa)
+{
+  switch (isa) {
+#ifdef KMEANS_X86
+  case DistanceKernels::AVX512: return sparseAVX512;
+  case DistanceKernels::AVX2: return sparseAVX2;
+  case DistanceKernels::SSE2: return sparseSSE2;
+#endif
+  default: return sparseScalar;
+  }
+}
+
+}
+
+DistanceKernels::Isa DistanceKernels::isa()
+{
+  return Isa(s_isa.load(std::memory_order_relaxed));
+}
+
+const char *DistanceKernels::isaName()
+{
+  switch (isa()) {
+  case AVX512: return "AVX-512";
+  case AVX2: return "AVX2";
+  case SSE2: return "SSE2";
+  default: return "Scalar";
+  }
+}
+
+int DistanceKernels::blockWidth()
+{
+  switch (isa()) {
+  case AVX512: return 16;
+  case AVX2: return 8;
+  case SSE2: return 4;
+  default: return 1;
+  }
+}
+
+int DistanceKernels::paddedStride(int count)
+{
+  const int width = blockWidth();
+  return (count + width - 1) / width * width;
+}
+
+void DistanceKernels::setIsa(Isa isa)
+{
+  s_isa.store(isa > s_supported ? s_supported : isa, std::memory_order_relaxed);
+}
+
+void DistanceKernels::pack(const float *centroids, int count, int dimension, int stride, float *packed)
+{
+  for (int d = 0; d < dimension; d++) {
+    float *row = packed + std::size_t(d) * stride;
+    for (int j = 0; j < count; j++) {
+      row[j] = centroids[std::size_t(j) * dimension + d];
+    }
+    for (int j = count; j < stride; j++) {
+      row[j] = 0.0f;
+    }
+  }
+}
+
+void DistanceKernels::squaredDistances(const float *point, const float *packed, int dimension, int stride, float *out)
+{
+  blockKernel(isa())(point, packed, dimension, stride, out);
+}
+
+void DistanceKernels::sparseSquaredDistances(const int *columns, const float *values, int count, float norm,
+                                             const float *packed, const float *norms, int stride, float *out)
+{
+  sparseKernel(isa())(columns, values, count, norm, packed, norms, stride, out);
+}
+
+float DistanceKernels::squaredDistance(const float *a, const float *b, int dimension)
+{
+  switch (isa()) {
+#ifdef KMEANS_X86
+  case AVX512: return pairAVX512(a, b, dimension);
+  case AVX2: return pairAVX2(a, b, dimension);
+  case SSE2: return pairSSE2(a, b, dimension);
+#endif
+  default: return pairScalar(a, b, dimension);
+  }
+}
+
+void DistanceKernels::decodeHalf(const std::uint16_t *in, int count, float *out)
+{
+#ifdef KMEANS_X86
+  if(isa() >= AVX2 && s_f16c) return decodeHalfAVX2(in, count, out);
+#endif
+  for (int i = 0; i < count; i++) out[i] = halfToFloat(in[i]);
+}
+
+void DistanceKernels::decodeInt8(const std::int8_t *in, const float *scale, const float *offset, int count, float *out)
+{
+#ifdef KMEANS_X86
+  if(isa() >= AVX2) return decodeInt8AVX2(in, scale, offset, count, out);
+#endif
+  for (int i = 0; i < count; i++) out[i] = offset[i] + scale[i] * in[i];
+}
+
+float DistanceKernels::minimum(const float *values, int count)
+{
+#ifdef KMEANS_X86
+  if(isa() != Scalar) return minSSE2(values, count);
+#endif
+  float min = values[0];
+  for (int j = 1; j < count; j++) min = values[j] < min ? values[j] : min;
+  return min;
+}
@@ -0,0 +1,54 @@
+#ifndef DISTANCEKERNELS_H
+#define DISTANCEKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Squared euclidean distance kernels shared by initialization, the step
+// kernels and energy/prediction. The block kernel compares one point
+// against a block of centroids stored transposed: coordinate d of
+// centroid j lives at packed[d * stride + j]. The instruction set is
+// picked once at runtime (AVX-512, AVX2+FMA, SSE2, scalar).
+namespace DistanceKernels
+{
+  enum Isa {
+    Scalar = 0,
+    SSE2,
+    AVX2,
+    AVX512
+  };
+
+  Isa isa();
+  const char *isaName();
+  // Lanes per vector of the selected kernel; packed strides are multiples of it
+  int blockWidth();
+  // Rounds a centroid count up to a valid packed stride
+  int paddedStride(int count);
+
+  // Writes packed[d * stride + j] = centroids[j * dimension + d], zero padded
+  void pack(const float *centroids, int count, int dimension, int stride, float *packed);
+  // out[j] = |point - centroid j|^2 for j < stride
+  void squaredDistances(const float *point, const float *packed, int dimension, int stride, float *out);
+  // Vectorized across the dimension, so it may differ from the matching
+  // squaredDistances() lane in the last bits
+  float squaredDistance(const float *a, const float *b, int dimension);
+  // Sparse point (count nonzeros at columns, squared norm norm) against
+  // packed centroids with squared norms norms[0 .. stride):
+  // out[j] = norm + norms[j] - 2 point . centroid j, clamped at 0. Reads one
+  // packed row per nonzero; cancellation makes it less exact than
+  // squaredDistances() for points close to a centroid.
+  void sparseSquaredDistances(const int *columns, const float *values, int count, float norm,
+                              const float *packed, const float *norms, int stride, float *out);
+  // Smallest of values[0 .. count), count > 0
+  float minimum(const float *values, int count);
+
+  // Expand compressed point rows (see QuantizedPoints.h) to floats
+  void decodeHalf(const std::uint16_t *in, int count, float *out);
+  // out[d] = offset[d] + scale[d] * in[d]
+  void decodeInt8(const std::int8_t *in, const float *scale, const float *offset, int count, float *out);
+
+  // Forces a kernel (clamped to what the CPU supports), used for validation
+  void setIsa(Isa isa);
+}
+
+#endif // DISTANCEKERNELS_H
@@ -0,0 +1,1130 @@
+#include "KMeansEngine.h"
+#include "BinaryFormat.h"
+#include "DistanceKernels.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "SparsePoints.h"
+#include "TextLoader.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <random>
+#include <thread>
+
+namespace {
+
+inline float squaredDistanceScalar(const float *a, const float *b, int dimension)
+{
+  float sum = 0.0f;
+  for (int k = 0; k < dimension; k++) {
+    float d = a[k] - b[k];
+    sum += d * d;
+  }
+  return sum;
+}
+
+// |row j|^2 for count rows, zero padded up to size
+void squaredNorms(const float *rows, int count, int dimension, int size, std::vector<float> &out)
+{
+  out.assign(size, 0.0f);
+  for (int j = 0; j < count; j++) {
+    const float *r = rows + std::size_t(j) * dimension;
+    double norm = 0.0;
+    for (int d = 0; d < dimension; d++) norm += double(r[d]) * r[d];
+    out[j] = float(norm);
+  }
+}
+
+} // namespace
+
+KMeansEngine::KMeansEngine()
+  : m_random(0, SequentialStream),
+    m_pool(new ThreadPool())
+{
+}
+
+void KMeansEngine::setSeed(std::uint64_t seed)
+{
+  m_seed = seed;
+  m_random.seed(seed, SequentialStream);
+}
+
+bool KMeansEngine::takeTie(std::uint64_t seed, long long point, int iteration, int centroid)
+{
+  return CounterRng::uniform(seed, TieStream, std::uint32_t(point), std::uint32_t(iteration), std::uint32_t(centroid)) < 0.5;
+}
+
+void KMeansEngine::setThreadCount(int count)
+{
+  if(count < 1) count = ThreadPool::defaultThreadCount();
+  if(count != m_pool->threadCount()) m_pool.reset(new ThreadPool(count));
+}
+
+int KMeansEngine::threadCount() const
+{
+  return m_pool->threadCount();
+}
+
+void KMeansEngine::setPoints(const float *data, int count, int dimension)
+{
+  resizePoints(count, dimension);
+  std::memcpy(m_points.data(), data, m_points.size() * sizeof(float));
+}
+
+void KMeansEngine::resizePoints(int count, int dimension)
+{
+  clear();
+  m_pointNumber = count;
+  m_dimension = dimension;
+  m_points.assign(std::size_t(count) * dimension, 0.0f);
+  m_pointData = m_points.data();
+}
+
+void KMeansEngine::generatePoints(int dimension, int count, float low, float high)
+{
+  resizePoints(count, dimension);
+  // Uniformly sample cube, every coordinate keyed by its position
+  const std::uint64_t key = m_random.next64();
+  const float range = high - low;
+  float *points = m_points.data();
+  m_pool->parallelFor(0, count, [&](int begin, int end, int) {
+    for (std::size_t i = std::size_t(begin) * dimension; i < std::size_t(end) * dimension; i++) {
+      const double u = CounterRng::uniform(key, PointStream, std::uint32_t(i), std::uint32_t(i >> 32));
+      points[i] = std::min(high, low + float(u * range));
+    }
+  });
+}
+
+bool KMeansEngine::loadTextFile(const std::string &path, std::string &error)
+{
+  KMEANS_PROFILE_SCOPE(Load);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  clear();
+  MappedFile file;
+  if(!file.open(path)){
+    error = "Cannot open " + path;
+    return false;
+  }
+  file.adviseSequential();
+  TextLoader::Header header;
+  if(!TextLoader::parseHeader(file.data(), file.size(), header, error)) return false;
+  // Every value takes a digit and a separator, a header claiming more values
+  // than that is rejected before the points are allocated
+  const std::size_t values = std::size_t(header.count) * std::size_t(header.dimension);
+  if(values > (file.size() - header.size + 1) / 2){
+    error = "Header claims " + std::to_string(header.count) + " x " + std::to_string(header.dimension)
+        + " values, more than the file holds";
+    return false;
+  }
+  try {
+    resizePoints(header.count, header.dimension);
+  } catch (const std::bad_alloc &) {
+    clear();
+    error = "Not enough memory for " + std::to_string(header.count) + " points";
+    return false;
+  }
+  if(!TextLoader::parseRows(file.data() + header.size, file.size() - header.size, header,
+                            m_points.data(), *m_pool, error)){
+    clear();
+    return false;
+  }
+  m_loadStats.bytes = file.size();
+  m_loadStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+bool KMeansEngine::loadBinaryFile(const std::string &path, std::string &error)
+{
+  KMEANS_PROFILE_SCOPE(Load);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  clear();
+  std::unique_ptr<MappedFile> file(new MappedFile());
+  if(!file->open(path)){
+    error = "Cannot open " + path;
+    return false;
+  }
+  const char *data = file->data();
+  BinaryFormat::Layout layout;
+  bool parsed = BinaryFormat::isNpy(data, file->size()) ? BinaryFormat::parseNpy(data, file->size(), layout, error)
+                                                        : BinaryFormat::parseNative(data, file->size(), layout, error);
+  if(!parsed) return false;
+  if(layout.count > 0x7fffffff){
+    error = "Too many points";
+    return false;
+  }
+  const int count = int(layout.count);
+  const int dimension = layout.dimension;
+  if(layout.dtype == BinaryFormat::Float32 && !layout.fortranOrder){
+    //Used in place, the pages are only read when touched
+    m_pointNumber = count;
+    m_dimension = dimension;
+    m_pointData = reinterpret_cast<const float *>(data + layout.dataOffset);
+    if(layout.labelOffset) m_fileLabels = reinterpret_cast<const int *>(data + layout.labelOffset);
+    if(layout.weightOffset) m_weights = reinterpret_cast<const float *>(data + layout.weightOffset);
+    m_mapped = std::move(file);
+  }else{
+    //float64 or column-major .npy arrays are converted into an owned buffer
+    resizePoints(count, dimension);
+    const char *values = data + layout.dataOffset;
+    m_pool->parallelFor(0, count, [&](int begin, int end, int) {
+      for (int i = begin; i < end; i++) {
+        for (int d = 0; d < dimension; d++) {
+          std::size_t index = layout.fortranOrder ? std::size_t(d) * count + i : std::size_t(i) * dimension + d;
+          if(layout.dtype == BinaryFormat::Float64){
+            double value;
+            std::memcpy(&value, values + index * sizeof(double), sizeof(double));
+            m_points[std::size_t(i) * dimension + d] = float(value);
+          }else{
+            float value;
+            std::memcpy(&value, values + index * sizeof(float), sizeof(float));
+            m_points[std::size_t(i) * dimension + d] = value;
+          }
+        }
+      }
+    });
+  }
+  m_loadStats.bytes = layout.dataOffset + std::size_t(count) * dimension
+      * (layout.dtype == BinaryFormat::Float64 ? sizeof(double) : sizeof(float));
+  m_loadStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+bool KMeansEngine::loadSparseFile(const std::string &path, std::string &error)
+{
+  KMEANS_PROFILE_SCOPE(Load);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  clear();
+  MappedFile file;
+  if(!file.open(path)){
+    error = "Cannot open " + path;
+    return false;
+  }
+  file.adviseSequential();
+  std::shared_ptr<SparsePoints> sparse(new SparsePoints());
+  if(!TextLoader::parseSparse(file.data(), file.size(), *sparse, *m_pool, error)) return false;
+  // Hashed feature ids can put the largest index near 2^32
+  if(std::size_t(sparse->dimension()) * 2 > MaxCentroidValues){
+    error = "Largest feature index " + std::to_string(sparse->dimension())
+        + " is too large for dense centroids";
+    return false;
+  }
+  m_sparse = sparse;
+  m_pointNumber = sparse->count();
+  m_dimension = sparse->dimension();
+  m_loadStats.bytes = file.size();
+  m_loadStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+void KMeansEngine::setSparsePoints(std::shared_ptr<const SparsePoints> points)
+{
+  clear();
+  m_sparse = points;
+  m_pointNumber = points->count();
+  m_dimension = points->dimension();
+}
+
+bool KMeansEngine::loadFile(const std::string &path, std::string &error)
+{
+  MappedFile file;
+  if(!file.open(path)){
+    error = "Cannot open " + path;
+    return false;
+  }
+  const bool binary = BinaryFormat::isNative(file.data(), file.size()) || BinaryFormat::isNpy(file.data(), file.size());
+  const bool sparse = !binary && TextLoader::isSparse(file.data(), file.size());
+  file.close();
+  if(sparse) return loadSparseFile(path, error);
+  return binary ? loadBinaryFile(path, error) : loadTextFile(path, error);
+}
+
+bool KMeansEngine::saveBinaryFile(const std::string &path, std::string &error) const
+{
+  if(m_pointNumber == 0){
+    error = "No points to save";
+    return false;
+  }
+  if(m_sparse){
+    error = "Sparse points have no binary format";
+    return false;
+  }
+  return BinaryFormat::write(path, m_pointData, m_pointNumber, m_dimension, m_fileLabels, m_weights, error);
+}
+
+//Clear points, centroids and labels
+void KMeansEngine::clear()
+{
+  m_pruning.invalidate();
+  m_points = AlignedBuffer<float>();
+  m_pointData = nullptr;
+  m_fileLabels = nullptr;
+  m_weights = nullptr;
+  m_mapped.reset();
+  m_sparse.reset();
+  m_quantized.reset();
+  m_tree.reset();
+  m_refinedFraction = 0.0f;
+  m_centroids.clear();
+  m_class.clear();
+  m_seeds.clear();
+  m_history.clear();
+  m_pointNumber = 0;
+  m_K = 0;
+  m_iteration = 0;
+  m_energy = 0.0f;
+}
+
+bool KMeansEngine::initialize(int k, int mode)
+{
+  if (k<2||k>m_pointNumber) return false;
+  if (std::size_t(k) * m_dimension > MaxCentroidValues) return false;
+  KMEANS_PROFILE_SCOPE(Initialize);
+  m_K = k;
+  // Draws come from the sequential stream of the seeded counter-based
+  // generator, RandomReal centroids are uniform in [-20, 20]
+  std::uniform_real_distribution<float> distribution(-20.0, 20.0);
+  m_centroids.clear();
+  m_centroids.reserve(std::size_t(m_K) * m_dimension);
+  m_seeds.clear();
+  m_class.assign(m_pointNumber, 0);
+  m_drift.assign(m_K, 0.0f);
+  m_pruning.invalidate();
+  if(mode == RandomReal){
+    for (std::size_t i=0; i<std::size_t(m_dimension) * m_K; i++){
+      m_centroids.push_back(distribution(m_random));
+    }
+  }else if(mode == RandomSample){
+    for (int i=0; i<m_K; i++){
+      int x = (distribution(m_random)+20) / 40 * m_pointNumber;
+      if(x >= m_pointNumber) x = m_pointNumber - 1;
+      addSeed(x);
+    }
+  }else if(mode == KMeansParallel){
+    seedParallel();
+  }else{
+    seedPlusPlus();
+  }
+  m_iteration = 0;
+  m_energy = 0.0f;
+  m_evaluations = 0;
+  resetMiniBatch();
+  m_history.reset(m_class.data(), m_pointNumber, m_centroids.data(), int(m_centroids.size()), m_iteration, m_energy);
+  return true;
+}
+
+void KMeansEngine::addSeed(int index)
+{
+  m_seeds.push_back(index);
+  m_centroids.resize(m_centroids.size() + m_dimension);
+  copyPoint(index, m_centroids.data() + (m_centroids.size() - m_dimension));
+}
+
+void KMeansEngine::copyPoint(int index, float *out) const
+{
+  if(m_sparse){
+    m_sparse->toDense(index, out);
+  }else{
+    std::memcpy(out, m_pointData + std::size_t(index) * m_dimension, std::size_t(m_dimension) * sizeof(float));
+  }
+}
+
+// |point index - c|^2, norm = |c|^2 is only read for sparse points
+float KMeansEngine::pointDistance(int index, const float *c, float norm) const
+{
+  if(m_sparse) return m_sparse->squaredDistance(index, c, norm);
+  return squaredDistanceScalar(m_pointData + std::size_t(index) * m_dimension, c, m_dimension);
+}
+
+// Lowers m_minDistances (squared distance to the closest seed so far) with
+// count new seeds stored row-major, and returns the new total. Per-chunk
+// totals are kept so sampleByDistance() only scans one chunk. When nearest
+// is given it tracks the index of the closest seed, numbered from firstSeed.
+double KMeansEngine::updateMinDistances(const float *seeds, int count, int *nearest, int firstSeed)
+{
+  const int chunks = reductionChunks(m_pointNumber);
+  m_chunkSums.assign(chunks, 0.0);
+  m_chunkBegin.assign(chunks, 0);
+  m_chunkEnd.assign(chunks, 0);
+  int stride = 0;
+  if(count > 1){
+    stride = DistanceKernels::paddedStride(count);
+    m_seedPacked.resize(std::size_t(stride) * m_dimension);
+    DistanceKernels::pack(seeds, count, m_dimension, stride, m_seedPacked.data());
+  }
+  std::vector<float> norms;
+  if(m_sparse) squaredNorms(seeds, count, m_dimension, std::max(stride, 1), norms);
+  m_pool->parallelFor(0, m_pointNumber, chunks, [&](int begin, int end, int chunk) {
+    std::vector<float> distances(stride);
+    double sum = 0.0;
+    for (int i = begin; i < end; i++) {
+      const float *p = m_sparse ? nullptr : m_pointData + std::size_t(i) * m_dimension;
+      float min;
+      if(m_sparse && count > 1){
+        DistanceKernels::sparseSquaredDistances(m_sparse->columns(i), m_sparse->values(i), m_sparse->size(i),
+                                                m_sparse->squaredNorm(i), m_seedPacked.data(), norms.data(),
+                                                stride, distances.data());
+        min = DistanceKernels::minimum(distances.data(), count);
+      }else if(m_sparse){
+        min = m_sparse->squaredDistance(i, seeds, norms[0]);
+      }else if(count > 1){
+        DistanceKernels::squaredDistances(p, m_seedPacked.data(), m_dimension, stride, distances.data());
+        min = DistanceKernels::minimum(distances.data(), count);
+      }else if(m_dimension < SmallDimension){
+        min = squaredDistanceScalar(p, seeds, m_dimension);
+      }else{
+        min = DistanceKernels::squaredDistance(p, seeds, m_dimension);
+      }
+      if(min < m_minDistances[i]){
+        m_minDistances[i] = min;
+        if(nearest){
+          nearest[i] = firstSeed;
+          if(count > 1) nearest[i] += int(std::find(distances.begin(), distances.end(), min) - distances.begin());
+        }
+      }
+      sum += m_minDistances[i];
+    }
+    m_chunkSums[chunk] = sum;
+    m_chunkBegin[chunk] = begin;
+    m_chunkEnd[chunk] = end;
+  });
+  double total = 0.0;
+  for (double sum : m_chunkSums) total += sum;
+  return total;
+}
+
+// Draws a point with probability proportional to m_minDistances
+int KMeansEngine::sampleByDistance(double total)
+{
+  if(!(total > 0.0)){
+    std::uniform_int_distribution<int> uniform(0, m_pointNumber - 1);
+    return uniform(m_random);
+  }
+  std::uniform_real_distribution<double> distribution(0.0, total);
+  double r = distribution(m_random);
+  int chunk = 0;
+  const int chunks = int(m_chunkSums.size());
+  while(chunk < chunks - 1 && (r >= m_chunkSums[chunk] || m_chunkBegin[chunk] == m_chunkEnd[chunk])){
+    r -= m_chunkSums[chunk];
+    chunk++;
+  }
+  //Rounding can run past the end, fall back to the last point that counts
+  int last = m_chunkBegin[chunk];
+  for (int i = m_chunkBegin[chunk]; i < m_chunkEnd[chunk]; i++) {
+    if(m_minDistances[i] <= 0.0f) continue;
+    last = i;
+    r -= m_minDistances[i];
+    if(r < 0.0) return i;
+  }
+  return last;
+}
+
+// k-means++ (Arthur & Vassilvitskii 2007): each seed is drawn with
+// probability proportional to the squared distance to the closest seed so
+// far, keeping one running minimum per point so the whole pass is O(N K D).
+void KMeansEngine::seedPlusPlus()
+{
+  std::uniform_int_distribution<int> uniform(0, m_pointNumber - 1);
+  m_minDistances.assign(m_pointNumber, std::numeric_limits<float>::max());
+  addSeed(uniform(m_random));
+  for (int i = 1; i < m_K; i++) {
+    double total = updateMinDistances(m_centroids.data() + std::size_t(i - 1) * m_dimension, 1);
+    addSeed(sampleByDistance(total));
+  }
+  m_minDistances = std::vector<float>();
+}
+
+// k-means|| (Bahmani et al. 2012): a few rounds each oversample ~2K points
+// in parallel with probability proportional to their squared distance, the
+// candidates are weighted by how many points they are closest to and
+// reduced to K seeds with weighted k-means++.
+void KMeansEngine::seedParallel()
+{
+  const double oversampling = 2.0 * m_K;
+  std::uniform_int_distribution<int> uniform(0, m_pointNumber - 1);
+  m_minDistances.assign(m_pointNumber, std::numeric_limits<float>::max());
+  std::vector<int> candidates(1, uniform(m_random));
+  std::vector<int> nearest(m_pointNumber, 0);
+  std::vector<float> coords(m_dimension);
+  copyPoint(candidates[0], coords.data());
+  double total = updateMinDistances(coords.data(), 1, nearest.data(), 0);
+  //Picks stay in point order, the draw for point i in a round is keyed by (i, round)
+  const std::uint64_t key = m_random.next64();
+  const int chunks = reductionChunks(m_pointNumber);
+  std::vector<std::vector<int>> picks(chunks);
+  for (int round = 0; round < KMeansParallelRounds && total > 0.0; round++) {
+    m_pool->parallelFor(0, m_pointNumber, chunks, [&](int begin, int end, int chunk) {
+      picks[chunk].clear();
+      for (int i = begin; i < end; i++) {
+        const double u = CounterRng::uniform(key, OversampleStream, std::uint32_t(i), std::uint32_t(round));
+        if(u * total < oversampling * m_minDistances[i]) picks[chunk].push_back(i);
+      }
+    });
+    coords.clear();
+    const int firstSeed = int(candidates.size());
+    for (const std::vector<int> &chunk : picks) {
+      for (int index : chunk) {
+        candidates.push_back(index);
+        coords.resize(coords.size() + m_dimension);
+        copyPoint(index, coords.data() + (coords.size() - m_dimension));
+      }
+    }
+    if(!coords.empty()) total = updateMinDistances(coords.data(), int(coords.size() / m_dimension), nearest.data(), firstSeed);
+  }
+  const int count = int(candidates.size());
+  if(count <= m_K){
+    //Too few candidates, keep them all and top up with D² sampling
+    for (int index : candidates) addSeed(index);
+    while(int(m_seeds.size()) < m_K){
+      addSeed(sampleByDistance(total));
+      total = updateMinDistances(m_centroids.data() + (m_centroids.size() - m_dimension), 1);
+    }
+    m_minDistances = std::vector<float>();
+    return;
+  }
+  m_minDistances = std::vector<float>();
+
+  //Weight every candidate by the number of points closest to it
+  std::vector<double> weights(count, 0.0);
+  for (int index : nearest) weights[index] += 1.0;
+  coords.resize(std::size_t(count) * m_dimension);
+  for (int c = 0; c < count; c++) copyPoint(candidates[c], coords.data() + std::size_t(c) * m_dimension);
+
+  //Weighted k-means++ over the candidates
+  std::vector<float> minDistances(count, std::numeric_limits<float>::max());
+  std::vector<double> probability(weights);
+  std::vector<char> taken(count, 0);
+  for (int i = 0; i < m_K; i++) {
+    std::discrete_distribution<int> distribution(probability.begin(), probability.end());
+    int chosen = distribution(m_random);
+    if(taken[chosen]){
+      //Every remaining weight was zero, take the first unused candidate
+      chosen = int(std::find(taken.begin(), taken.end(), 0) - taken.begin());
+    }
+    taken[chosen] = 1;
+    addSeed(candidates[chosen]);
+    const float *c = coords.data() + std::size_t(chosen) * m_dimension;
+    for (int j = 0; j < count; j++) {
+      float distance = DistanceKernels::squaredDistance(coords.data() + std::size_t(j) * m_dimension, c, m_dimension);
+      if(distance < minDistances[j]) minDistances[j] = distance;
+      probability[j] = taken[j] ? 0.0 : weights[j] * minDistances[j];
+    }
+  }
+}
+
+// One streaming pass over the points assigns, accumulates the centroid sums
+// and the energy, so energy() refers to the centroids the points were
+// assigned against (the ones before this step moved them).
+bool KMeansEngine::step()
+{
+  if(!isInitialized()) return false;
+  bool moved;
+  if(m_algorithm == MiniBatch){
+    moved = miniBatchStep();
+  }else{
+    packCentroids(m_K);
+    m_partials.resize(reductionChunks(m_pointNumber));
+    for (ChunkAccumulator &acc : m_partials) acc.active = false;
+    {
+      KMEANS_PROFILE_SCOPE(Assign);
+      if(m_sparse){
+        //The bounds and the tree need dense rows, sparse points always take the full pass
+        assignAndAccumulate(nullptr, m_pointNumber);
+      }else if(m_algorithm == BoundPruned || m_algorithm == Yinyang){
+        BoundPruning::Input in = {m_pointData, m_pointNumber, m_dimension, m_centroids.data(),
+                                  m_packed.data(), m_stride, m_K, m_drift.data()};
+        BoundPruning::Variant variant = m_algorithm == Yinyang ? BoundPruning::Yinyang
+                                                               : BoundPruning::chooseVariant(m_pointNumber, m_dimension, m_K);
+        m_pruning.assign(in, variant, m_class.data(), *m_pool, m_partials);
+      }else if(m_algorithm == KdFilter){
+        buildTree();
+        m_tree->assign(m_centroids.data(), m_K, m_class.data(), *m_pool, m_partials);
+      }else{
+        assignAndAccumulate(nullptr, m_pointNumber);
+      }
+    }
+    moved = updateCentroids();
+    m_iteration += 1;
+  }
+  KMEANS_PROFILE_COUNT(DistanceEvaluations, m_evaluations);
+  //Mini-batch steps only relabel their batch
+  if(m_algorithm == MiniBatch){
+    m_history.record(m_class.data(), m_centroids.data(), m_iteration, m_energy, m_batch.data(), int(m_batch.size()));
+  }else{
+    m_history.record(m_class.data(), m_centroids.data(), m_iteration, m_energy);
+  }
+  return moved;
+}
+
+bool KMeansEngine::run(int maxIterations)
+{
+  if(!isInitialized()) return false;
+  while(m_iteration < maxIterations){
+    if(!step()) return true;
+  }
+  return false;
+}
+
+bool KMeansEngine::runRestarts(int k, int mode, int restarts, int maxIterations, const std::atomic<bool> *cancel)
+{
+  if(k<2||k>m_pointNumber||restarts<1) return false;
+  if(std::size_t(k) * m_dimension > MaxCentroidValues) return false;
+  buildStorage();
+  if(m_algorithm == KdFilter) buildTree();
+  //Trials run side by side when there are cores to spare
+  const int groups = std::min(restarts, m_pool->threadCount());
+  const int threadsPerGroup = std::max(1, m_pool->threadCount() / groups);
+  std::vector<std::uint64_t> seeds(restarts);
+  for (std::uint64_t &seed : seeds) seed = m_random.next64();
+  m_restartStats = RestartStats();
+  m_restartStats.energies.assign(restarts, 0.0f);
+  m_restartStats.iterations.assign(restarts, 0);
+  std::vector<char> converged(restarts, 0);
+  //Each group keeps only the centroids of its best trial
+  std::vector<std::vector<float> > bestCentroids(groups);
+  std::vector<int> bestTrial(groups, -1);
+  std::atomic<int> next(0);
+  auto runGroup = [&](int group) {
+    KMeansEngine trial;
+    shareTrial(trial, threadsPerGroup);
+    for (int t = next++; t < restarts; t = next++) {
+      trial.setSeed(seeds[t]);
+      trial.initialize(k, mode);
+      converged[t] = trial.runTrial(maxIterations, cancel);
+      if(cancel && cancel->load()) return;
+      const float energy = trial.fullEnergy();
+      m_restartStats.energies[t] = energy;
+      m_restartStats.iterations[t] = trial.m_iteration;
+      if(bestTrial[group] < 0 || energy < m_restartStats.energies[bestTrial[group]]){
+        bestTrial[group] = t;
+        bestCentroids[group].assign(trial.m_centroids.begin(), trial.m_centroids.end());
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int g = 1; g < groups; g++) threads.emplace_back(runGroup, g);
+  runGroup(0);
+  for (std::thread &thread : threads) thread.join();
+  if(cancel && cancel->load()){
+    m_restartStats = RestartStats();
+    return false;
+  }
+  //Equal energies go to the lower trial, whichever group ran it
+  int best = -1;
+  for (int g = 0; g < groups; g++) {
+    if(bestTrial[g] < 0) continue;
+    if(best < 0){
+      best = g;
+      continue;
+    }
+    const float energy = m_restartStats.energies[bestTrial[g]];
+    const float bestEnergy = m_restartStats.energies[bestTrial[best]];
+    if(energy < bestEnergy || (energy == bestEnergy && bestTrial[g] < bestTrial[best])) best = g;
+  }
+  m_restartStats.best = bestTrial[best];
+  //Adopt the winner, one assignment pass restores its labels
+  m_K = k;
+  m_centroids.assign(bestCentroids[best].begin(), bestCentroids[best].end());
+  m_seeds.clear();
+  m_class.assign(m_pointNumber, 0);
+  m_drift.assign(m_K, 0.0f);
+  m_pruning.invalidate();
+  resetMiniBatch();
+  fullEnergy();
+  m_energy = m_restartStats.energies[m_restartStats.best];
+  m_iteration = m_restartStats.iterations[m_restartStats.best];
+  m_history.reset(m_class.data(), m_pointNumber, m_centroids.data(), int(m_centroids.size()), m_iteration, m_energy);
+  return converged[m_restartStats.best] != 0;
+}
+
+bool KMeansEngine::sweepK(int first, int last, int mode, int maxIterations, const std::atomic<bool> *cancel)
+{
+  first = std::max(first, 2);
+  last = std::min(last, m_pointNumber);
+  if(first > last || std::size_t(last) * m_dimension > MaxCentroidValues) return false;
+  buildStorage();
+  if(m_algorithm == KdFilter) buildTree();
+  //Contiguous K ranges, split so each gets a similar sum of K (the
+  //per-step cost), are pulled by groups of threads running side by side
+  const int count = last - first + 1;
+  const int segments = std::min(count, SweepSegments);
+  const int groups = std::min(segments, m_pool->threadCount());
+  const int threadsPerGroup = std::max(1, m_pool->threadCount() / groups);
+  std::vector<int> segmentFirst(segments + 1, last + 1);
+  const double total = (double(first) + last) * count / 2.0;
+  int split = first;
+  for (int s = 0; s < segments; s++) {
+    segmentFirst[s] = split;
+    double sum = 0.0;
+    while(split <= last && (sum < total / segments || split == segmentFirst[s]) && last - split >= segments - 1 - s){
+      sum += split;
+      split++;
+    }
+  }
+  std::vector<std::uint64_t> seeds(segments);
+  for (std::uint64_t &seed : seeds) seed = m_random.next64();
+  std::vector<SweepResult> results(count);
+  std::atomic<int> next(0);
+  auto runGroup = [&](int) {
+    KMeansEngine trial;
+    shareTrial(trial, threadsPerGroup);
+    //Same labels as Lloyd for a fraction of the distances
+    if(trial.m_algorithm == Lloyd) trial.m_algorithm = BoundPruned;
+    for (int s = next++; s < segments; s = next++) {
+      trial.setSeed(seeds[s]);
+      for (int k = segmentFirst[s]; k < segmentFirst[s + 1]; k++) {
+        //The first K of a range starts cold, the rest split the previous solution
+        if(k == segmentFirst[s]){
+          trial.initialize(k, mode);
+        }else{
+          trial.splitWorstCluster();
+        }
+        SweepResult &result = results[k - first];
+        result.k = k;
+        //Split clusters creep along for many steps that barely move the curve
+        trial.runTrial(maxIterations, cancel, SweepTolerance);
+        if(cancel && cancel->load()) return;
+        result.iterations = trial.m_iteration;
+        result.energy = trial.fullEnergy();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int g = 1; g < groups; g++) threads.emplace_back(runGroup, g);
+  runGroup(0);
+  for (std::thread &thread : threads) thread.join();
+  if(cancel && cancel->load()) return false;
+  m_sweepResults.swap(results);
+  return true;
+}
+
+// Partial sums are split by the point count alone, so they are added in
+// the same order on any number of threads. Large K x D gets fewer chunks to
+// bound the memory of the partials. Sparse chunks also hold at least
+// dimension nonzeros, or clearing and merging the dense partial sums would
+// cost more than the kernel.
+int KMeansEngine::reductionChunks(int count) const
+{
+  const std::size_t row = std::size_t(std::max(m_K, 1)) * m_dimension * sizeof(double);
+  std::size_t budget = std::max<std::size_t>(1, ReductionBytes / std::max<std::size_t>(row, 1));
+  if(m_sparse && m_pointNumber > 0){
+    const double nonZeros = double(m_sparse->nonZeros()) * count / m_pointNumber;
+    budget = std::min(budget, std::max<std::size_t>(1, std::size_t(nonZeros / std::max(m_dimension, 1))));
+  }
+  const int chunks = std::min(MaxReductionChunks, std::max(1, count / MinChunkPoints));
+  return int(std::min<std::size_t>(chunks, budget));
+}
+
+//Trial engines read this engine's points and copy its settings
+void KMeansEngine::shareTrial(KMeansEngine &trial, int threads) const
+{
+  trial.setThreadCount(threads);
+  trial.m_pointData = m_pointData;
+  trial.m_sparse = m_sparse;
+  trial.m_pointNumber = m_pointNumber;
+  trial.m_dimension = m_dimension;
+  trial.m_algorithm = m_algorithm;
+  trial.m_batchSize = m_batchSize;
+  trial.m_storage = m_storage;
+  trial.m_quantized = m_quantized;
+  trial.m_tree = m_tree;
+  trial.m_exactRefinement = m_exactRefinement;
+  trial.setHistoryCapacity(0, 0);
+}
+
+bool KMeansEngine::runTrial(int maxIterations, const std::atomic<bool> *cancel, float tolerance)
+{
+  float previous = 0.0f;
+  while(m_iteration < maxIterations){
+    if(cancel && cancel->load()) return false;
+    if(!step()) return true;
+    if(previous > 0.0f && previous - m_energy < tolerance * previous) return true;
+    previous = m_energy;
+  }
+  return false;
+}
+
+// Warm start for K + 1: the cluster with the largest energy gets a second
+// centroid halfway between its centroid and its farthest point. Labels must
+// match the current centroids (fullEnergy() leaves them that way).
+void KMeansEngine::splitWorstCluster()
+{
+  const int chunks = reductionChunks(m_pointNumber);
+  std::vector<float> norms;
+  if(m_sparse) squaredNorms(m_centroids.data(), m_K, m_dimension, m_K, norms);
+  std::vector<double> energies(std::size_t(chunks) * m_K, 0.0);
+  m_pool->parallelFor(0, m_pointNumber, chunks, [&](int begin, int end, int chunk) {
+    double *e = energies.data() + std::size_t(chunk) * m_K;
+    for (int i = begin; i < end; i++) {
+      const int label = m_class[i];
+      e[label] += std::sqrt(pointDistance(i, m_centroids.data() + std::size_t(label) * m_dimension,
+                                          m_sparse ? norms[label] : 0.0f));
+    }
+  });
+  int worst = 0;
+  double worstEnergy = -1.0;
+  for (int j = 0; j < m_K; j++) {
+    double e = 0.0;
+    for (int t = 0; t < chunks; t++) e += energies[std::size_t(t) * m_K + j];
+    if(e > worstEnergy){
+      worstEnergy = e;
+      worst = j;
+    }
+  }
+  const float *c = m_centroids.data() + std::size_t(worst) * m_dimension;
+  int farthest = -1;
+  float farthestDistance = -1.0f;
+  for (int i = 0; i < m_pointNumber; i++) {
+    if(m_class[i] != worst) continue;
+    const float distance = pointDistance(i, c, m_sparse ? norms[worst] : 0.0f);
+    if(distance > farthestDistance){
+      farthestDistance = distance;
+      farthest = i;
+    }
+  }
+  std::vector<float> split(c, c + m_dimension);
+  if(farthest >= 0){
+    std::vector<float> p(m_dimension);
+    copyPoint(farthest, p.data());
+    for (int d = 0; d < m_dimension; d++) split[d] = 0.5f * (split[d] + p[d]);
+  }
+  m_centroids.insert(m_centroids.end(), split.begin(), split.end());
+  m_K += 1;
+  m_drift.assign(m_K, 0.0f);
+  m_seeds.clear();
+  m_iteration = 0;
+  m_energy = 0.0f;
+  m_pruning.invalidate();
+  resetMiniBatch();
+}
+
+void KMeansEngine::setCentroids(const float *data)
+{
+  std::memcpy(m_centroids.data(), data, m_centroids.size() * sizeof(float));
+  m_pruning.invalidate();
+  resetMiniBatch();
+  //Recorded steps no longer lead to these centroids
+  m_history.reset(m_class.data(), m_pointNumber, m_centroids.data(), int(m_centroids.size()), m_iteration, m_energy);
+}
+
+void KMeansEngine::setHistoryCapacity(int steps, std::size_t bytes)
+{
+  m_history.setCapacity(steps, bytes);
+}
+
+bool KMeansEngine::stepBack()
+{
+  if(!m_history.back(m_class.data())) return false;
+  restoreHistory();
+  return true;
+}
+
+bool KMeansEngine::stepForward()
+{
+  if(!m_history.forward(m_class.data())) return false;
+  restoreHistory();
+  return true;
+}
+
+//Labels were already moved by the history, the rest comes from the entry
+void KMeansEngine::restoreHistory()
+{
+  StepHistory::State state = m_history.current();
+  std::memcpy(m_centroids.data(), state.centroids, m_centroids.size() * sizeof(float));
+  m_iteration = state.iteration;
+  m_energy = state.energy;
+  m_drift.assign(m_K, 0.0f);
+  m_pruning.invalidate();
+  resetMiniBatch();
+}
+
+void KMeansEngine::snapshot(Snapshot &out) const
+{
+  out.iteration = m_iteration;
+  out.clusterCount = m_K;
+  out.energy = m_energy;
+  out.skippedFraction = skippedFraction();
+  out.refinedFraction = m_refinedFraction;
+  out.storageBytes = storageBytes();
+  out.centroids.assign(m_centroids.begin(), m_centroids.end());
+  out.labels.assign(m_class.begin(), m_class.end());
+}
+
+void KMeansEngine::setAlgorithm(int algorithm)
+{
+  if(algorithm != m_algorithm){
+    m_pruning.invalidate();
+    resetMiniBatch();
+  }
+  m_algorithm = algorithm;
+}
+
+void KMeansEngine::setStorage(int storage)
+{
+  if(storage != m_storage) m_quantized.reset();
+  m_storage = storage;
+}
+
+void KMeansEngine::buildStorage()
+{
+  if(m_storage == Float32 || m_quantized || m_pointNumber == 0 || m_sparse) return;
+  std::shared_ptr<QuantizedPoints> quantized(new QuantizedPoints());
+  quantized->build(m_pointData, m_pointNumber, m_dimension, m_storage, *m_pool);
+  m_quantized = quantized;
+}
+
+void KMeansEngine::buildTree()
+{
+  if(m_tree || m_sparse) return;
+  KMEANS_PROFILE_SCOPE(Load);
+  std::shared_ptr<KdTree> tree(new KdTree());
+  tree->build(m_pointData, m_pointNumber, m_dimension, *m_pool);
+  m_tree = tree;
+}
+
+void KMeansEngine::setBatchSize(int size)
+{
+  m_batchSize = std::max(1, size);
+}
+
+void KMeansEngine::resetMiniBatch()
+{
+  m_seen.assign(m_K, 0.0);
+  m_ewaEnergy = -1.0;
+  m_bestEwaEnergy = -1.0;
+  m_noImprovement = 0;
+}
+
+// Mini-batch k-means (Sculley 2010): assign a random batch, then move each
+// centroid towards the mean of its batch points with a learning rate of
+// 1 / (points it has seen so far). energy() becomes an exponentially
+// weighted estimate from the batches, fullEnergy() computes the real one.
+bool KMeansEngine::miniBatchStep()
+{
+  const int batch = std::min(m_batchSize, m_pointNumber);
+  std::uniform_int_distribution<int> distribution(0, m_pointNumber - 1);
+  m_batch.resize(batch);
+  for (int &index : m_batch) index = distribution(m_random);
+  //Sorted and unique so the pass streams forward and labels have one writer
+  std::sort(m_batch.begin(), m_batch.end());
+  m_batch.erase(std::unique(m_batch.begin(), m_batch.end()), m_batch.end());
+  packCentroids(m_K);
+  m_partials.resize(reductionChunks(int(m_batch.size())));
+  for (ChunkAccumulator &acc : m_partials) acc.active = false;
+  {
+    KMEANS_PROFILE_SCOPE(Assign);
+    assignAndAccumulate(m_batch.data(), int(m_batch.size()));
+  }
+  ChunkAccumulator &total = m_partials[0];
+  for (std::size_t t = 1; t < m_partials.size(); t++) {
+    if(m_partials[t].active) total.merge(m_partials[t]);
+  }
+  m_evaluations = total.evaluations;
+  m_refinedFraction = float(double(total.refined) / m_batch.size());
+  double movement = 0.0;
+  for (int i = 0; i < m_K; i++) {
+    m_drift[i] = 0.0f;
+    if(total.counts[i] == 0) continue;
+    const double seen = m_seen[i];
+    m_seen[i] += total.counts[i];
+    float *c = m_centroids.data() + std::size_t(i) * m_dimension;
+    const double *s = total.sums.data() + std::size_t(i) * m_dimension;
+    double drift = 0.0;
+    for (int k = 0; k < m_dimension; k++) {
+      float updated = float((c[k] * seen + s[k]) / m_seen[i]);
+      drift += double(updated - c[k]) * (updated - c[k]);
+      c[k] = updated;
+    }
+    m_drift[i] = float(std::sqrt(drift));
+    movement += drift;
+  }
+  //Exponentially weighted average of the per-point batch energy
+  const double batchEnergy = total.energy / double(m_batch.size());
+  //(floored so the estimate still tracks the early steps on large data)
+  const double alpha = std::min(1.0, std::max(0.1, 2.0 * batch / (m_pointNumber + 1.0)));
+  m_ewaEnergy = m_ewaEnergy < 0 ? batchEnergy : m_ewaEnergy * (1.0 - alpha) + batchEnergy * alpha;
+  m_energy = float(m_ewaEnergy * m_pointNumber);
+  m_iteration += 1;
+  if(m_bestEwaEnergy < 0 || m_ewaEnergy < m_bestEwaEnergy){
+    m_bestEwaEnergy = m_ewaEnergy;
+    m_noImprovement = 0;
+  }else{
+    m_noImprovement++;
+  }
+  //Converged once centroids barely move relative to the typical point
+  //distance, or the smoothed energy stopped improving
+  const double scale = batchEnergy * batchEnergy;
+  if(movement / m_K <= MiniBatchTolerance * scale) return false;
+  return m_noImprovement < MiniBatchMaxNoImprovement;
+}
+
+float KMeansEngine::fullEnergy()
+{
+  if(!isInitialized()) return 0.0f;
+  KMEANS_PROFILE_SCOPE(Energy);
+  packCentroids(m_K);
+  m_partials.resize(reductionChunks(m_pointNumber));
+  for (ChunkAccumulator &acc : m_partials) acc.active = false;
+  assignAndAccumulate(nullptr, m_pointNumber, true);
+  //The relabel replaces the current step's labels in the history
+  m_history.relabel(m_class.data());
+  double energy = 0.0;
+  for (const ChunkAccumulator &acc : m_partials) {
+    if(acc.active) energy += acc.energy;
+  }
+  if(m_algorithm != MiniBatch) m_pruning.invalidate();
+  return float(energy);
+}
+
+float KMeansEngine::skippedFraction() const
+{
+  const double total = double(m_pointNumber) * m_K;
+  if(total <= 0 || m_evaluations == 0) return 0.0f;
+  return float(1.0 - m_evaluations / total);
+}
+
+// Assigns points indices[0 .. count) (or 0 .. count when indices is null).
+// exact reads the float32 points even when a compressed storage is set.
+void KMeansEngine::assignAndAccumulate(const int *indices, int count, bool exact)
+{
+  if(!exact) buildStorage();
+  const QuantizedPoints *quantized = exact ? nullptr : m_quantized.get();
+  const bool refine = quantized && m_exactRefinement;
+  m_pool->parallelFor(0, count, int(m_partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = m_partials[chunk];
+    acc.reset(m_K, m_dimension);
+    std::vector<float> distances(m_stride);
+    std::vector<float> decoded(quantized ? m_dimension : 0);
+    //Nearest centroid of p and the squared distance to the runner-up
+    float second;
+    auto nearest = [&](int i, const float *p, float &min) {
+      if(m_sparse){
+        DistanceKernels::sparseSquaredDistances(m_sparse->columns(i), m_sparse->values(i), m_sparse->size(i),
+                                                m_sparse->squaredNorm(i), m_packed.data(), m_centroidNorms.data(),
+                                                m_stride, distances.data());
+      }else{
+        DistanceKernels::squaredDistances(p, m_packed.data(), m_dimension, m_stride, distances.data());
+      }
+      min = distances[0];
+      second = std::numeric_limits<float>::max();
+      int label = 0;
+      for (int j = 1; j < m_K; j++) {
+        float distance = distances[j];
+        if(distance < min){
+          second = min;
+          min = distance;
+          label = j;
+        }else if(distance == min){
+          second = min;
+          //Equal distance 50% chance change class, keyed so the choice
+          //does not depend on which chunk the point fell in
+          if(takeTie(m_seed, i, m_iteration, j)) label = j;
+        }else if(distance < second){
+          second = distance;
+        }
+      }
+      return label;
+    };
+    for (int n = begin; n < end; n++) {
+      const int i = indices ? indices[n] : n;
+      const float *p = m_sparse ? nullptr : m_pointData + std::size_t(i) * m_dimension;
+      float min;
+      int label;
+      if(quantized){
+        quantized->decode(i, decoded.data());
+        label = nearest(i, decoded.data(), min);
+        //Exact distances are within error(i) of the decoded ones, a smaller
+        //margin than twice that may hide a different nearest centroid
+        if(refine && std::sqrt(second) - std::sqrt(min) <= 2.0f * quantized->error(i)){
+          label = nearest(i, p, min);
+          acc.refined++;
+          acc.evaluations += m_K;
+        }else{
+          p = decoded.data();
+        }
+      }else{
+        label = nearest(i, p, min);
+      }
+      m_class[i] = label;
+      if(m_sparse){
+        acc.addSparse(m_sparse->columns(i), m_sparse->values(i), m_sparse->size(i), m_dimension, label, std::sqrt(min));
+      }else{
+        acc.add(p, m_dimension, label, std::sqrt(min));
+      }
+    }
+    acc.evaluations += (long long)(end - begin) * m_K;
+  });
+}
+
+bool KMeansEngine::updateCentroids()
+{
+  KMEANS_PROFILE_SCOPE(Update);
+  //Reduce the chunks that ran into chunk 0's buffers
+  ChunkAccumulator &total = m_partials[0];
+  for (std::size_t t = 1; t < m_partials.size(); t++) {
+    if(m_partials[t].active) total.merge(m_partials[t]);
+  }
+  m_energy = float(total.energy);
+  m_evaluations = total.evaluations;
+  m_refinedFraction = float(double(total.refined) / m_pointNumber);
+  bool dirty = false;
+  for (int i = 0; i < m_K; i++) {
+    float *c = m_centroids.data() + std::size_t(i) * m_dimension;
+    const double *s = total.sums.data() + std::size_t(i) * m_dimension;
+    double drift = 0.0;
+    //Empty clusters keep their previous position
+    if(total.counts[i] > 0){
+      for (int k = 0; k < m_dimension; k++) {
+        float mean = float(s[k] / total.counts[i]);
+        if(mean != c[k]){
+          drift += double(mean - c[k]) * (mean - c[k]);
+          c[k] = mean;
+          dirty = true;
+        }
+      }
+    }
+    m_drift[i] = float(std::sqrt(drift));
+  }
+  return dirty;
+}
+
+void KMeansEngine::packCentroids(int count)
+{
+  m_stride = DistanceKernels::paddedStride(count);
+  m_packed.resize(std::size_t(m_stride) * m_dimension);
+  DistanceKernels::pack(m_centroids.data(), count, m_dimension, m_stride, m_packed.data());
+  if(m_sparse) squaredNorms(m_centroids.data(), count, m_dimension, m_stride, m_centroidNorms);
+}
+
+float KMeansEngine::euclideanDistance(int centroid_index, int point_index) const
+{
+  if(m_sparse){
+    const float *c = m_centroids.data() + std::size_t(centroid_index) * m_dimension;
+    std::vector<float> norm;
+    squaredNorms(c, 1, m_dimension, 1, norm);
+    return std::sqrt(pointDistance(point_index, c, norm[0]));
+  }
+  return std::sqrt(DistanceKernels::squaredDistance(m_centroids.data() + std::size_t(centroid_index) * m_dimension,
+                                                    m_pointData + std::size_t(point_index) * m_dimension,
+                                                    m_dimension));
+}
+
+float KMeansEngine::energyCalculation() const
+{
+  KMEANS_PROFILE_SCOPE(Energy);
+  float energy = 0;
+  if(m_sparse){
+    std::vector<float> norms;
+    squaredNorms(m_centroids.data(), m_K, m_dimension, m_K, norms);
+    for(int i=0; i<m_pointNumber; i++){
+      energy += std::sqrt(pointDistance(i, m_centroids.data() + std::size_t(m_class[i]) * m_dimension, norms[m_class[i]]));
+    }
+    return energy;
+  }
+  for(int i=0; i<m_pointNumber; i++){
+    energy += euclideanDistance(m_class[i], i);
+  }
+  return energy;
+}
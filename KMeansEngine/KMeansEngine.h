@@ -0,0 +1,310 @@
+#ifndef KMEANSENGINE_H
+#define KMEANSENGINE_H
+
+#include "AlignedBuffer.h"
+#include "BoundPruning.h"
+#include "ChunkAccumulator.h"
+#include "CounterRng.h"
+#include "KdTree.h"
+#include "MappedFile.h"
+#include "QuantizedPoints.h"
+#include "SparsePoints.h"
+#include "StepHistory.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Headless k-means state and algorithms. Owns the point/centroid buffers
+// (row-major, point i starts at i * dimension()) and can be driven without
+// any GL context or window.
+class KMeansEngine
+{
+public:
+  enum InitMode {
+    RandomReal = 0,
+    RandomSample = 1,
+    KMeansPlusPlus = 2,
+    KMeansParallel = 3
+  };
+
+  enum Algorithm {
+    Lloyd = 0,
+    BoundPruned = 1,
+    Yinyang = 2,
+    MiniBatch = 3,
+    // KD-tree filtering, for D <= ~6
+    KdFilter = 4
+  };
+
+  enum Storage {
+    Float32 = 0,
+    Float16 = QuantizedPoints::Float16,
+    Int8 = QuantizedPoints::Int8
+  };
+
+  // Copy of the state the view renders, taken between steps so another
+  // thread can keep stepping the engine
+  struct Snapshot
+  {
+    int iteration = 0;
+    int clusterCount = 0;
+    float energy = 0.0f;
+    float skippedFraction = 0.0f;
+    float refinedFraction = 0.0f;
+    std::size_t storageBytes = 0;
+    std::vector<float> centroids;
+    std::vector<int> labels;
+  };
+
+  // Outcome of runRestarts(): final full energy and iterations per trial
+  struct RestartStats
+  {
+    std::vector<float> energies;
+    std::vector<int> iterations;
+    int best = -1;
+  };
+
+  // One K of sweepK(): full energy after the run and iterations it took
+  struct SweepResult
+  {
+    int k = 0;
+    float energy = 0.0f;
+    int iterations = 0;
+  };
+
+  // Size and wall time of the last successful file load
+  struct LoadStats
+  {
+    std::size_t bytes = 0;
+    double seconds = 0.0;
+  };
+
+  KMeansEngine();
+
+  // Threads used by the assignment/update kernels, 0 means all cores
+  void setThreadCount(int count);
+  int threadCount() const;
+  // Every random draw follows from this seed: sequential draws from one
+  // counter-based stream, per-point draws (generated points, k-means||
+  // oversampling, tie-breaking) keyed by point index and iteration. Together
+  // with partial sums split independently of the thread count, a seed gives
+  // the same points, seeds and labels bit for bit on any number of threads.
+  void setSeed(std::uint64_t seed);
+  std::uint64_t seed() const { return m_seed; }
+  // Seeded coin flip for an exact distance tie between the current nearest
+  // centroid and centroid j, shared with StreamingKMeans so both label alike
+  static bool takeTie(std::uint64_t seed, long long point, int iteration, int centroid);
+
+  // Data
+  void setPoints(const float *data, int count, int dimension);
+  void resizePoints(int count, int dimension);
+  void generatePoints(int dimension, int count, float low, float high);
+  // Text format: count and dimension lines, then one row per point. On
+  // failure returns false with a message and leaves no points loaded.
+  bool loadTextFile(const std::string &path, std::string &error);
+  // Native binary or .npy (see BinaryFormat.h). float32 row-major data is
+  // mapped and used in place instead of being copied.
+  bool loadBinaryFile(const std::string &path, std::string &error);
+  // SVMlight / LIBSVM text (see TextLoader.h) into a CSR point store.
+  // Sparse points are clustered with the sparse-dense kernel: points(),
+  // storage and the pruned and KD-tree algorithms do not apply, those run
+  // Lloyd's full pass. Centroids stay dense, so files whose largest feature
+  // index leaves no room for even K = 2 (see MaxCentroidValues) are refused.
+  bool loadSparseFile(const std::string &path, std::string &error);
+  void setSparsePoints(std::shared_ptr<const SparsePoints> points);
+  bool isSparse() const { return m_sparse != nullptr; }
+  // Null for dense points
+  std::shared_ptr<const SparsePoints> sparsePoints() const { return m_sparse; }
+  // Picks the binary, sparse or dense text loader from the file contents
+  bool loadFile(const std::string &path, std::string &error);
+  bool saveBinaryFile(const std::string &path, std::string &error) const;
+  const LoadStats &loadStats() const { return m_loadStats; }
+  void clear();
+
+  // Clustering
+  void setAlgorithm(int algorithm);
+  int algorithm() const { return m_algorithm; }
+  void setBatchSize(int size);
+  int batchSize() const { return m_batchSize; }
+  // Lloyd and mini-batch assignment can stream a compressed copy of the
+  // points (built on the first step after the points change) instead of the
+  // float32 points; the pruned and KD-tree algorithms and fullEnergy() stay
+  // on float32.
+  // Centroids are then means of the decoded points. Pays off for long rows
+  // (high D), where the pass is bound by memory bandwidth. The compressed
+  // copy is extra memory: the float32 rows stay for those paths and the
+  // view, so owned points take 1.5x (float16) or 1.25x (int8) in total and
+  // only the per-step traffic shrinks.
+  void setStorage(int storage);
+  int storage() const { return m_storage; }
+  // Owned float32 points plus the compressed copy; mapped files are page
+  // cache and not counted
+  std::size_t storageBytes() const { return m_points.size() * sizeof(float) + (m_quantized ? m_quantized->bytes() : 0); }
+  // Reassigns a point from its float32 row whenever the compression error
+  // could hide a closer centroid, so labels match the float32 assignment
+  void setExactRefinement(bool on) { m_exactRefinement = on; }
+  bool exactRefinement() const { return m_exactRefinement; }
+  // Share of the assigned points the last step had to refine
+  float refinedFraction() const { return m_refinedFraction; }
+  // False for an invalid K or one whose K x D centroids exceed MaxCentroidValues
+  bool initialize(int k, int mode);
+  bool step();
+  bool run(int maxIterations);
+  // n_init: runs restarts independent initialize + run trials concurrently
+  // on the shared points, one group of threads per trial, and keeps the
+  // trial with the lowest full energy. Returns whether that trial converged.
+  // Setting cancel stops all trials and leaves the engine unchanged.
+  bool runRestarts(int k, int mode, int restarts, int maxIterations, const std::atomic<bool> *cancel = nullptr);
+  const RestartStats &restartStats() const { return m_restartStats; }
+  // Clusters every K in [first, last] for an energy vs K (elbow) curve
+  // without touching this engine's clustering. Contiguous K ranges run
+  // concurrently, within a range each K warm starts from the previous
+  // solution with its worst cluster split. The ranges only depend on first
+  // and last, not on the thread count.
+  bool sweepK(int first, int last, int mode, int maxIterations, const std::atomic<bool> *cancel = nullptr);
+  const std::vector<SweepResult> &sweepResults() const { return m_sweepResults; }
+  float energy() const { return m_energy; }
+  // Mini-batch energy() is an estimate, this assigns every point and
+  // returns the exact full-data energy. The new labels replace those of
+  // the current history step.
+  float fullEnergy();
+  // Share of the N x K distance evaluations the last step did not need
+  float skippedFraction() const;
+  float energyCalculation() const;
+  float euclideanDistance(int centroid_index, int point_index) const;
+  void setCentroids(const float *data);
+  void snapshot(Snapshot &out) const;
+  // Every step is recorded (see StepHistory.h), these restore a recorded
+  // iteration without recomputing it
+  void setHistoryCapacity(int steps, std::size_t bytes);
+  bool canStepBack() const { return m_history.canBack(); }
+  bool canStepForward() const { return m_history.canForward(); }
+  bool stepBack();
+  bool stepForward();
+
+  // Read-only access for rendering
+  int pointCount() const { return m_pointNumber; }
+  int dimension() const { return m_dimension; }
+  int clusterCount() const { return m_K; }
+  int iteration() const { return m_iteration; }
+  void setIteration(int iteration) { m_iteration = iteration; }
+  bool isInitialized() const { return m_K > 1 && !m_centroids.empty(); }
+  // Dense rows, null for sparse points
+  const float *points() const { return m_pointData; }
+  // Writable storage after setPoints/resizePoints, empty for mapped files
+  float *pointData() { return m_points.data(); }
+  bool isMapped() const { return m_mapped != nullptr; }
+  // Optional per-point labels/weights stored in a binary file, or null
+  const int *fileLabels() const { return m_fileLabels; }
+  const float *weights() const { return m_weights; }
+  const float *centroids() const { return m_centroids.data(); }
+  const int *labels() const { return m_class.data(); }
+  const std::vector<int> &seedIndices() const { return m_seeds; }
+
+private:
+  void packCentroids(int count);
+  void addSeed(int index);
+  void copyPoint(int index, float *out) const;
+  float pointDistance(int index, const float *c, float norm) const;
+  double updateMinDistances(const float *seeds, int count, int *nearest = nullptr, int firstSeed = 0);
+  int sampleByDistance(double total);
+  void seedPlusPlus();
+  void seedParallel();
+  void assignAndAccumulate(const int *indices, int count, bool exact = false);
+  void buildStorage();
+  void buildTree();
+  bool miniBatchStep();
+  void resetMiniBatch();
+  bool updateCentroids();
+  void restoreHistory();
+  int reductionChunks(int count) const;
+  void shareTrial(KMeansEngine &trial, int threads) const;
+  bool runTrial(int maxIterations, const std::atomic<bool> *cancel, float tolerance = 0.0f);
+  void splitWorstCluster();
+
+  int m_K = 0;
+  int m_dimension = 3;
+  int m_pointNumber = 0;
+  int m_iteration = 0;
+  int m_algorithm = Lloyd;
+  float m_energy = 0.0f;
+  long long m_evaluations = 0;
+  // Points are either owned (m_points) or a view into m_mapped,
+  // m_pointData is what every kernel reads
+  AlignedBuffer<float> m_points;
+  std::unique_ptr<MappedFile> m_mapped;
+  const float *m_pointData = nullptr;
+  // CSR points instead of m_pointData, shared with restart/sweep trials
+  std::shared_ptr<const SparsePoints> m_sparse;
+  const int *m_fileLabels = nullptr;
+  const float *m_weights = nullptr;
+  // Compressed points for setStorage(), shared with restart/sweep trials
+  int m_storage = Float32;
+  std::shared_ptr<const QuantizedPoints> m_quantized;
+  bool m_exactRefinement = false;
+  // Built by the first KdFilter step after the points change, shared with trials
+  std::shared_ptr<const KdTree> m_tree;
+  float m_refinedFraction = 0.0f;
+  AlignedBuffer<float> m_centroids;
+  // Transposed copy of the centroids for the block distance kernel
+  AlignedBuffer<float> m_packed;
+  int m_stride = 0;
+  // |centroid|^2 per packed lane, for the sparse kernel
+  std::vector<float> m_centroidNorms;
+  std::vector<float> m_drift;
+  AlignedBuffer<int> m_class;
+  std::vector<int> m_seeds;
+  LoadStats m_loadStats;
+  RestartStats m_restartStats;
+  std::vector<SweepResult> m_sweepResults;
+  // Relative energy change that ends a K of the sweep early
+  static constexpr float SweepTolerance = 1e-4f;
+  static constexpr int SweepSegments = 16;
+  // Oversampling rounds of k-means||
+  static constexpr int KMeansParallelRounds = 5;
+  // Below this the one-seed update skips the dispatched pair kernel
+  static constexpr int SmallDimension = 16;
+  // Seeding scratch: squared distance of each point to its closest seed,
+  // summed per reduction chunk
+  std::vector<float> m_minDistances;
+  std::vector<double> m_chunkSums;
+  std::vector<int> m_chunkBegin;
+  std::vector<int> m_chunkEnd;
+  AlignedBuffer<float> m_seedPacked;
+  // Streams of the counter-based generator
+  enum RandomStream {
+    SequentialStream = 0,
+    PointStream,
+    OversampleStream,
+    TieStream
+  };
+  std::uint64_t m_seed = 0;
+  CounterRng m_random;
+  std::unique_ptr<ThreadPool> m_pool;
+  // Partial centroid sums and counts per reduction chunk, reduced in chunk
+  // order once per step. The chunks follow the point count, not the
+  // threads, within a memory budget for large K x D.
+  static constexpr int MinChunkPoints = 1024;
+  static constexpr int MaxReductionChunks = 64;
+  static constexpr std::size_t ReductionBytes = std::size_t(256) << 20;
+  // Largest K x D for the dense centroid buffers; the packed copy, a chunk
+  // of partial sums and the history add about three times that again
+  static constexpr std::size_t MaxCentroidValues = std::size_t(1) << 26;
+  std::vector<ChunkAccumulator> m_partials;
+  BoundPruning m_pruning;
+  StepHistory m_history;
+  // Mini-batch state: per-centroid points seen and smoothed batch energy
+  static constexpr double MiniBatchTolerance = 1e-6;
+  static constexpr int MiniBatchMaxNoImprovement = 10;
+  int m_batchSize = 1024;
+  std::vector<int> m_batch;
+  std::vector<double> m_seen;
+  double m_ewaEnergy = -1.0;
+  double m_bestEwaEnergy = -1.0;
+  int m_noImprovement = 0;
+};
+
+#endif // KMEANSENGINE_H
@@ -0,0 +1,43 @@
+TEMPLATE = lib
+# std::from_chars for floats needs C++17 (GCC 11, MSVC 2019)
+CONFIG += staticlib c++17
+CONFIG -= qt
+# qmake CONFIG+=profiling builds in the phase timers (see Profiler.h)
+profiling: DEFINES += KMEANS_PROFILING
+
+TARGET = KMeansEngine
+
+SOURCES += \
+    BinaryFormat.cpp \
+    BoundPruning.cpp \
+    DistanceKernels.cpp \
+    KdTree.cpp \
+    KMeansEngine.cpp \
+    MappedFile.cpp \
+    Profiler.cpp \
+    Projection.cpp \
+    QuantizedPoints.cpp \
+    SparsePoints.cpp \
+    StepHistory.cpp \
+    StreamingKMeans.cpp \
+    TextLoader.cpp \
+    ThreadPool.cpp
+
+HEADERS += \
+    AlignedBuffer.h \
+    BinaryFormat.h \
+    BoundPruning.h \
+    ChunkAccumulator.h \
+    CounterRng.h \
+    DistanceKernels.h \
+    KdTree.h \
+    KMeansEngine.h \
+    MappedFile.h \
+    Profiler.h \
+    Projection.h \
+    QuantizedPoints.h \
+    SparsePoints.h \
+    StepHistory.h \
+    StreamingKMeans.h \
+    TextLoader.h \
+    ThreadPool.h
@@ -0,0 +1,272 @@
+#include "KdTree.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+inline float squaredDistance(const float *a, const float *b, int dimension)
+{
+  float sum = 0.0f;
+  for (int d = 0; d < dimension; d++) {
+    float diff = a[d] - b[d];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+} // namespace
+
+void KdTree::clear()
+{
+  m_pointCount = 0;
+  m_depth = 0;
+  m_nodes = std::vector<Node>();
+  m_low = std::vector<float>();
+  m_high = std::vector<float>();
+  m_sums = std::vector<double>();
+  m_order = std::vector<int>();
+  m_ordered = std::vector<float>();
+  m_frontier.clear();
+}
+
+void KdTree::build(const float *points, int count, int dimension, ThreadPool &pool)
+{
+  clear();
+  if(count == 0) return;
+  m_pointCount = count;
+  m_dimension = dimension;
+  const std::size_t nodes = subtreeSize(count);
+  m_nodes.resize(nodes);
+  m_low.resize(nodes * dimension);
+  m_high.resize(nodes * dimension);
+  m_sums.assign(nodes * dimension, 0.0);
+  //Rows are reordered in place at every split, so each cell is contiguous
+  m_order.resize(count);
+  for (int i = 0; i < count; i++) m_order[i] = i;
+  m_ordered.assign(points, points + std::size_t(count) * dimension);
+  std::vector<Key> keys(count);
+  std::vector<float> rows(std::size_t(count) * dimension);
+  std::vector<int> order(count);
+  //The top levels are split here, the subtrees below them in parallel
+  int splitDepth = 0;
+  while((1 << splitDepth) < pool.threadCount() * 4) splitDepth++;
+  std::vector<Task> tasks;
+  buildNode(0, 0, count, 0, splitDepth, &tasks, keys, rows, order);
+  pool.parallelFor(0, int(tasks.size()), [&](int begin, int end, int) {
+    for (int t = begin; t < end; t++) {
+      buildNode(tasks[t].node, tasks[t].begin, tasks[t].end, tasks[t].depth, -1, nullptr, keys, rows, order);
+    }
+  });
+  finishSums(0, 0, splitDepth);
+  for (int n = count; n > LeafSize; n -= n / 2) m_depth++;
+  //Enough independent subtrees to keep every thread busy
+  m_frontier.assign(1, 0);
+  while(m_frontier.size() < std::size_t(FrontierSize)){
+    std::vector<int> next;
+    for (int node : m_frontier) {
+      if(m_nodes[node].left < 0){
+        next.push_back(node);
+      }else{
+        next.push_back(m_nodes[node].left);
+        next.push_back(m_nodes[node].right);
+      }
+    }
+    if(next.size() == m_frontier.size()) break;
+    m_frontier.swap(next);
+  }
+}
+
+// Nodes are laid out in preorder and the shape only depends on the point
+// count, so every subtree knows its index range before it is built
+std::size_t KdTree::subtreeSize(int count)
+{
+  if(count <= LeafSize) return 1;
+  return 1 + subtreeSize(count / 2) + subtreeSize(count - count / 2);
+}
+
+// Median split along the widest side of the cell's bounding box. Below
+// stopDepth the node is queued in tasks instead of being built; its
+// ancestors get their sums from finishSums() afterwards.
+void KdTree::buildNode(int index, int begin, int end, int depth, int stopDepth, std::vector<Task> *tasks,
+                       std::vector<Key> &keys, std::vector<float> &rows, std::vector<int> &order)
+{
+  const int D = m_dimension;
+  if(depth == stopDepth){
+    Task task = {index, begin, end, depth};
+    tasks->push_back(task);
+    return;
+  }
+  Node &node = m_nodes[index];
+  node.begin = begin;
+  node.end = end;
+  node.left = -1;
+  node.right = -1;
+  float *low = m_low.data() + std::size_t(index) * D;
+  float *high = m_high.data() + std::size_t(index) * D;
+  float *points = m_ordered.data();
+  std::copy(points + std::size_t(begin) * D, points + std::size_t(begin + 1) * D, low);
+  std::copy(points + std::size_t(begin) * D, points + std::size_t(begin + 1) * D, high);
+  for (int i = begin + 1; i < end; i++) {
+    const float *p = points + std::size_t(i) * D;
+    for (int d = 0; d < D; d++) {
+      low[d] = std::min(low[d], p[d]);
+      high[d] = std::max(high[d], p[d]);
+    }
+  }
+  if(end - begin <= LeafSize){
+    double *sum = m_sums.data() + std::size_t(index) * D;
+    for (int i = begin; i < end; i++) {
+      const float *p = points + std::size_t(i) * D;
+      for (int d = 0; d < D; d++) sum[d] += p[d];
+    }
+    return;
+  }
+  int axis = 0;
+  for (int d = 1; d < D; d++) {
+    if(high[d] - low[d] > high[axis] - low[axis]) axis = d;
+  }
+  const int middle = begin + (end - begin) / 2;
+  for (int i = begin; i < end; i++) {
+    Key key = {points[std::size_t(i) * D + axis], i};
+    keys[i] = key;
+  }
+  std::nth_element(keys.begin() + begin, keys.begin() + middle, keys.begin() + end,
+                   [](const Key &a, const Key &b) { return a.value < b.value; });
+  for (int i = begin; i < end; i++) {
+    const float *p = points + std::size_t(keys[i].position) * D;
+    std::copy(p, p + D, rows.begin() + std::size_t(i) * D);
+    order[i] = m_order[keys[i].position];
+  }
+  std::copy(rows.begin() + std::size_t(begin) * D, rows.begin() + std::size_t(end) * D, points + std::size_t(begin) * D);
+  std::copy(order.begin() + begin, order.begin() + end, m_order.begin() + begin);
+  const int left = index + 1;
+  const int right = left + int(subtreeSize(middle - begin));
+  node.left = left;
+  node.right = right;
+  buildNode(left, begin, middle, depth + 1, stopDepth, tasks, keys, rows, order);
+  buildNode(right, middle, end, depth + 1, stopDepth, tasks, keys, rows, order);
+  if(tasks) return;
+  double *sum = m_sums.data() + std::size_t(index) * D;
+  for (int d = 0; d < D; d++) {
+    sum[d] = m_sums[std::size_t(left) * D + d] + m_sums[std::size_t(right) * D + d];
+  }
+}
+
+// Sums of the nodes split before the parallel subtree builds
+void KdTree::finishSums(int index, int depth, int stopDepth)
+{
+  const Node &node = m_nodes[index];
+  if(depth == stopDepth || node.left < 0) return;
+  finishSums(node.left, depth + 1, stopDepth);
+  finishSums(node.right, depth + 1, stopDepth);
+  const int D = m_dimension;
+  double *sum = m_sums.data() + std::size_t(index) * D;
+  for (int d = 0; d < D; d++) {
+    sum[d] = m_sums[std::size_t(node.left) * D + d] + m_sums[std::size_t(node.right) * D + d];
+  }
+}
+
+void KdTree::assign(const float *centroids, int k, int *labels, ThreadPool &pool,
+                    std::vector<ChunkAccumulator> &partials) const
+{
+  pool.parallelFor(0, int(m_frontier.size()), int(partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = partials[chunk];
+    acc.reset(k, m_dimension);
+    //One candidate list per tree level
+    std::vector<int> candidates(std::size_t(m_depth + 2) * k);
+    for (int n = begin; n < end; n++) {
+      for (int j = 0; j < k; j++) candidates[j] = j;
+      filter(m_frontier[n], centroids, candidates.data(), k, labels, acc);
+    }
+  });
+}
+
+void KdTree::filter(int node, const float *centroids, int *candidates, int count, int *labels,
+                    ChunkAccumulator &acc) const
+{
+  const int D = m_dimension;
+  const Node &cell = m_nodes[node];
+  if(count == 1){
+    assignCell(node, centroids + std::size_t(candidates[0]) * D, candidates[0], labels, acc);
+    return;
+  }
+  if(cell.left < 0){
+    for (int i = cell.begin; i < cell.end; i++) {
+      const float *p = m_ordered.data() + std::size_t(i) * D;
+      float best = squaredDistance(p, centroids + std::size_t(candidates[0]) * D, D);
+      int label = candidates[0];
+      for (int c = 1; c < count; c++) {
+        const int j = candidates[c];
+        const float distance = squaredDistance(p, centroids + std::size_t(j) * D, D);
+        if(distance < best || (distance == best && j < label)){
+          best = distance;
+          label = j;
+        }
+      }
+      labels[m_order[i]] = label;
+      acc.add(p, D, label, std::sqrt(best));
+    }
+    acc.evaluations += (long long)(cell.end - cell.begin) * count;
+    return;
+  }
+  const float *low = m_low.data() + std::size_t(node) * D;
+  const float *high = m_high.data() + std::size_t(node) * D;
+  //Candidate closest to the cell center
+  int closest = -1;
+  float closestDistance = 0.0f;
+  for (int c = 0; c < count; c++) {
+    const int j = candidates[c];
+    const float *z = centroids + std::size_t(j) * D;
+    float distance = 0.0f;
+    for (int d = 0; d < D; d++) {
+      const float diff = 0.5f * (low[d] + high[d]) - z[d];
+      distance += diff * diff;
+    }
+    if(closest < 0 || distance < closestDistance || (distance == closestDistance && j < closest)){
+      closestDistance = distance;
+      closest = j;
+    }
+  }
+  //Keep z only if it beats the closest centroid at the cell corner
+  //furthest in the direction from the closest centroid towards z
+  const float *best = centroids + std::size_t(closest) * D;
+  int *kept = candidates + count;
+  int keptCount = 0;
+  kept[keptCount++] = closest;
+  for (int c = 0; c < count; c++) {
+    const int j = candidates[c];
+    if(j == closest) continue;
+    const float *z = centroids + std::size_t(j) * D;
+    float toZ = 0.0f;
+    float toBest = 0.0f;
+    for (int d = 0; d < D; d++) {
+      const float corner = z[d] > best[d] ? high[d] : low[d];
+      toZ += (z[d] - corner) * (z[d] - corner);
+      toBest += (best[d] - corner) * (best[d] - corner);
+    }
+    if(toZ < toBest || (toZ == toBest && j < closest)) kept[keptCount++] = j;
+  }
+  acc.evaluations += count + 2 * (count - 1);
+  if(keptCount == 1){
+    assignCell(node, best, closest, labels, acc);
+    return;
+  }
+  filter(cell.left, centroids, kept, keptCount, labels, acc);
+  filter(cell.right, centroids, kept, keptCount, labels, acc);
+}
+
+// Sums come from the node, labels and the energy still need every point.
+// The energy adds unsquared distances, which the cached moments cannot
+// give, so its per-point distances count as evaluations.
+void KdTree::assignCell(int node, const float *centroid, int label, int *labels, ChunkAccumulator &acc) const
+{
+  const int D = m_dimension;
+  const Node &cell = m_nodes[node];
+  double energy = 0.0;
+  for (int i = cell.begin; i < cell.end; i++) {
+    labels[m_order[i]] = label;
+    energy += std::sqrt(squaredDistance(m_ordered.data() + std::size_t(i) * D, centroid, D));
+  }
+  acc.addGroup(m_sums.data() + std::size_t(node) * D, D, label, cell.end - cell.begin, energy);
+  acc.evaluations += cell.end - cell.begin;
+}
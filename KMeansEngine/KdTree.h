@@ -0,0 +1,77 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include "ChunkAccumulator.h"
+#include "ThreadPool.h"
+#include <vector>
+
+// Filtering assignment (Kanungo et al. 2002) for low dimensional data. The
+// tree is built once per point set; every node caches its bounding box and
+// the sum and count of its points. A step walks the tree with a shrinking
+// candidate list: a centroid is dropped from a cell when the centroid
+// closest to the cell center is closer to every corner of the cell, and a
+// cell left with a single candidate is assigned whole through its cached
+// sum. Only the leaves reached with several candidates compare single
+// points against several centroids; whole cells still take one distance
+// per point for the energy, which counts toward the evaluations. Exact
+// ties go to the lowest candidate instead of a random one.
+class KdTree
+{
+public:
+  bool isEmpty() const { return m_pointCount == 0; }
+  void build(const float *points, int count, int dimension, ThreadPool &pool);
+  void clear();
+  // Assigns every point and accumulates it into partials[chunk], split
+  // into partials.size() chunks whatever the thread count
+  void assign(const float *centroids, int k, int *labels, ThreadPool &pool, std::vector<ChunkAccumulator> &partials) const;
+
+private:
+  struct Node
+  {
+    // Points m_order[begin .. end), children are -1 for leaves
+    int begin;
+    int end;
+    int left;
+    int right;
+  };
+  // Split value and row of one point during the build
+  struct Key
+  {
+    float value;
+    int position;
+  };
+  // Subtree left for the parallel part of the build
+  struct Task
+  {
+    int node;
+    int begin;
+    int end;
+    int depth;
+  };
+  static std::size_t subtreeSize(int count);
+  void buildNode(int index, int begin, int end, int depth, int stopDepth, std::vector<Task> *tasks,
+                 std::vector<Key> &keys, std::vector<float> &rows, std::vector<int> &order);
+  void finishSums(int index, int depth, int stopDepth);
+  void filter(int node, const float *centroids, int *candidates, int count, int *labels, ChunkAccumulator &acc) const;
+  void assignCell(int node, const float *centroid, int label, int *labels, ChunkAccumulator &acc) const;
+
+  static const int LeafSize = 16;
+  // Subtrees the parallel walk starts from, fixed so the chunks of the walk
+  // do not depend on the thread count
+  static const int FrontierSize = 256;
+  int m_pointCount = 0;
+  int m_dimension = 0;
+  int m_depth = 0;
+  std::vector<Node> m_nodes;
+  // Per node: bounding box and coordinate sums, dimension values each
+  std::vector<float> m_low;
+  std::vector<float> m_high;
+  std::vector<double> m_sums;
+  // Point indices in tree order and the points copied in that order, cells
+  // are contiguous ranges of both
+  std::vector<int> m_order;
+  std::vector<float> m_ordered;
+  std::vector<int> m_frontier;
+};
+
+#endif // KDTREE_H
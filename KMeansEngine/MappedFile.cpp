@@ -0,0 +1,110 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <vector>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const std::string &path)
+{
+  close();
+  int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+  if(length <= 0) return false;
+  std::vector<wchar_t> wide(length);
+  MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, wide.data(), length);
+  HANDLE file = CreateFileW(wide.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(file, &size)){
+    CloseHandle(file);
+    return false;
+  }
+  m_file = file;
+  m_size = std::size_t(size.QuadPart);
+  m_open = true;
+  //Empty files cannot be mapped, they simply have no data
+  if(m_size == 0) return true;
+  m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if(m_mapping) m_data = static_cast<const char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+  if(!m_data){
+    close();
+    return false;
+  }
+  return true;
+}
+
+//No madvise equivalent for mapped views, the prefetcher handles linear scans
+void MappedFile::adviseSequential()
+{
+}
+
+void MappedFile::close()
+{
+  if(m_data) UnmapViewOfFile(m_data);
+  if(m_mapping) CloseHandle(m_mapping);
+  if(m_file) CloseHandle(m_file);
+  m_data = nullptr;
+  m_mapping = nullptr;
+  m_file = nullptr;
+  m_size = 0;
+  m_open = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path)
+{
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+  struct stat info;
+  if(fstat(fd, &info) != 0){
+    ::close(fd);
+    return false;
+  }
+  m_size = std::size_t(info.st_size);
+  m_open = true;
+  //Empty files cannot be mapped, they simply have no data
+  if(m_size > 0){
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED){
+      ::close(fd);
+      m_size = 0;
+      m_open = false;
+      return false;
+    }
+    m_data = static_cast<const char *>(data);
+  }
+  //The mapping keeps the file referenced
+  ::close(fd);
+  return true;
+}
+
+void MappedFile::adviseSequential()
+{
+  if(m_data) madvise(const_cast<char *>(m_data), m_size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::close()
+{
+  if(m_data) munmap(const_cast<char *>(m_data), m_size);
+  m_data = nullptr;
+  m_size = 0;
+  m_open = false;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The pages are only read in as
+// they are touched, so opening is cheap regardless of the file size.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // path is UTF-8
+  bool open(const std::string &path);
+  void close();
+  bool isOpen() const { return m_open; }
+  const char *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+  // Hint for a single front to back pass, lets the OS read ahead
+  void adviseSequential();
+
+private:
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  bool m_open = false;
+#if defined(_WIN32)
+  void *m_file = nullptr;
+  void *m_mapping = nullptr;
+#endif
+};
+
+#endif // MAPPEDFILE_H
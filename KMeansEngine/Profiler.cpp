@@ -0,0 +1,105 @@
+#include "Profiler.h"
+#include "BinaryFormat.h"
+#include <cstdio>
+
+namespace {
+
+//Small stable ids read better in the trace viewer than native thread ids
+int threadIndex()
+{
+  static std::atomic<int> next(1);
+  static thread_local int index = next++;
+  return index;
+}
+
+} // namespace
+
+Profiler &Profiler::instance()
+{
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::Profiler()
+  : m_origin(std::chrono::steady_clock::now())
+{
+  reset();
+}
+
+const char *Profiler::phaseName(Phase phase)
+{
+  static const char *const names[PhaseCount] = {"Initialize", "Assign", "Update", "Energy", "Load", "Upload", "Draw"};
+  return phase >= 0 && phase < PhaseCount ? names[phase] : "Unknown";
+}
+
+void Profiler::addTime(Phase phase, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+  const long long duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  m_lastNs[phase] = duration;
+  m_totalNs[phase] += duration;
+  m_calls[phase]++;
+  Event event = {int(phase), threadIndex(),
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(begin - m_origin).count(), duration};
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_events.size() < MaxEvents){
+    m_events.push_back(event);
+  }else{
+    m_events[m_next] = event;
+  }
+  m_next = (m_next + 1) % MaxEvents;
+}
+
+Profiler::PhaseStats Profiler::phaseStats(Phase phase) const
+{
+  PhaseStats stats;
+  stats.lastMs = m_lastNs[phase] * 1e-6;
+  stats.totalMs = m_totalNs[phase] * 1e-6;
+  stats.calls = m_calls[phase];
+  return stats;
+}
+
+void Profiler::reset()
+{
+  for (int i = 0; i < PhaseCount; i++) {
+    m_lastNs[i] = 0;
+    m_totalNs[i] = 0;
+    m_calls[i] = 0;
+  }
+  for (int i = 0; i < CounterCount; i++) {
+    m_counters[i] = 0;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_events.clear();
+  m_next = 0;
+}
+
+//Complete ("X") events in microseconds, oldest first
+bool Profiler::writeChromeTrace(const std::string &path, std::string &error) const
+{
+  std::vector<Event> events;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    events.reserve(m_events.size());
+    const std::size_t first = m_events.size() < MaxEvents ? 0 : m_next;
+    for (std::size_t i = 0; i < m_events.size(); i++) {
+      events.push_back(m_events[(first + i) % m_events.size()]);
+    }
+  }
+  std::FILE *file = BinaryFormat::openFile(path, "wb");
+  if(!file){
+    error = "Cannot open " + path + " for writing";
+    return false;
+  }
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (std::size_t i = 0; i < events.size(); i++) {
+    const Event &e = events[i];
+    std::fprintf(file, "{\"name\":\"%s\",\"cat\":\"kmeans\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                 phaseName(Phase(e.phase)), e.thread, e.begin * 1e-3, e.duration * 1e-3, i + 1 < events.size() ? "," : "");
+  }
+  std::fprintf(file, "]}\n");
+  if(std::fclose(file) != 0){
+    error = "Writing " + path + " failed";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,102 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide phase timers and counters. Each timed scope adds to its
+// phase totals and appends one complete event to a bounded ring, which
+// writeChromeTrace() saves in the Chrome trace-event format (load it in
+// chrome://tracing or Perfetto). Scopes wrap whole steps, loads and frames,
+// never per-point work, so the clock reads and the lock are negligible.
+//
+// Only built in with DEFINES += KMEANS_PROFILING (qmake CONFIG+=profiling);
+// otherwise the KMEANS_PROFILE_* macros expand to nothing.
+class Profiler
+{
+public:
+  enum Phase {
+    Initialize = 0,
+    Assign,
+    Update,
+    Energy,
+    Load,
+    Upload,
+    Draw,
+    PhaseCount
+  };
+
+  enum Counter {
+    DistanceEvaluations = 0,
+    BytesUploaded,
+    CounterCount
+  };
+
+  struct PhaseStats
+  {
+    double lastMs = 0.0;
+    double totalMs = 0.0;
+    long long calls = 0;
+  };
+
+  static Profiler &instance();
+  static const char *phaseName(Phase phase);
+
+  void addTime(Phase phase, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+  void addCount(Counter counter, long long value) { m_counters[counter] += value; }
+  PhaseStats phaseStats(Phase phase) const;
+  long long count(Counter counter) const { return m_counters[counter].load(); }
+  void reset();
+  bool writeChromeTrace(const std::string &path, std::string &error) const;
+
+  class ScopedTimer
+  {
+  public:
+    //The profiler is created first so its origin precedes the first scope
+    explicit ScopedTimer(Phase phase)
+      : m_profiler(Profiler::instance()), m_phase(phase), m_begin(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { m_profiler.addTime(m_phase, m_begin, std::chrono::steady_clock::now()); }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  private:
+    Profiler &m_profiler;
+    Phase m_phase;
+    std::chrono::steady_clock::time_point m_begin;
+  };
+
+private:
+  struct Event
+  {
+    int phase;
+    int thread;
+    long long begin;
+    long long duration;
+  };
+
+  Profiler();
+
+  static const std::size_t MaxEvents = std::size_t(1) << 20;
+  const std::chrono::steady_clock::time_point m_origin;
+  std::atomic<long long> m_lastNs[PhaseCount];
+  std::atomic<long long> m_totalNs[PhaseCount];
+  std::atomic<long long> m_calls[PhaseCount];
+  std::atomic<long long> m_counters[CounterCount];
+  mutable std::mutex m_mutex;
+  // Ring of the latest events, m_next is the slot written next
+  std::vector<Event> m_events;
+  std::size_t m_next = 0;
+};
+
+#ifdef KMEANS_PROFILING
+#define KMEANS_PROFILE_SCOPE(phase) Profiler::ScopedTimer profileScope(Profiler::phase)
+#define KMEANS_PROFILE_COUNT(counter, value) Profiler::instance().addCount(Profiler::counter, (value))
+#else
+#define KMEANS_PROFILE_SCOPE(phase) do {} while(0)
+#define KMEANS_PROFILE_COUNT(counter, value) do {} while(0)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,220 @@
+#include "Projection.h"
+#include "SparsePoints.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+
+//Gram-Schmidt on the three length-dimension columns of basis (stored as rows)
+void orthonormalize(std::vector<double> &basis, int dimension, std::default_random_engine &engine)
+{
+  std::normal_distribution<double> distribution;
+  for (int c = 0; c < 3; c++) {
+    double *v = basis.data() + std::size_t(c) * dimension;
+    for (int attempt = 0; attempt < 2; attempt++) {
+      for (int p = 0; p < c; p++) {
+        const double *u = basis.data() + std::size_t(p) * dimension;
+        double dot = 0.0;
+        for (int d = 0; d < dimension; d++) dot += u[d] * v[d];
+        for (int d = 0; d < dimension; d++) v[d] -= dot * u[d];
+      }
+      double norm = 0.0;
+      for (int d = 0; d < dimension; d++) norm += v[d] * v[d];
+      norm = std::sqrt(norm);
+      if(norm > 1e-12){
+        for (int d = 0; d < dimension; d++) v[d] /= norm;
+        break;
+      }
+      //Rank deficient sample, continue from a random direction
+      for (int d = 0; d < dimension; d++) v[d] = distribution(engine);
+    }
+  }
+}
+
+} // namespace
+
+Projection::Projection(int threadCount)
+  : m_pool(new ThreadPool(threadCount))
+{
+}
+
+void Projection::fit(const float *points, int count, int dimension, Method method, unsigned seed)
+{
+  m_dimension = dimension;
+  std::default_random_engine engine(seed);
+  std::normal_distribution<double> distribution;
+  const int sampleSize = std::min(count, SampleSize);
+  std::vector<const float *> sample(sampleSize);
+  for (int s = 0; s < sampleSize; s++) {
+    sample[s] = points + std::size_t((long long)s * count / sampleSize) * dimension;
+  }
+  std::vector<double> mean(dimension, 0.0);
+  for (const float *p : sample) {
+    for (int d = 0; d < dimension; d++) mean[d] += p[d];
+  }
+  for (double &value : mean) value /= std::max(1, sampleSize);
+  std::vector<double> basis(std::size_t(3) * dimension);
+  for (double &value : basis) value = distribution(engine);
+  orthonormalize(basis, dimension, engine);
+  if(method == PrincipalComponents){
+    //Subspace iteration: basis <- orth(X^T X basis) on the centered sample,
+    //each round is one parallel pass with per-chunk partial sums
+    std::vector<std::vector<double> > partials(m_pool->threadCount());
+    for (int round = 0; round < PowerIterations; round++) {
+      m_pool->parallelFor(0, sampleSize, [&](int begin, int end, int chunk) {
+        std::vector<double> &acc = partials[chunk];
+        acc.assign(std::size_t(3) * dimension, 0.0);
+        for (int s = begin; s < end; s++) {
+          const float *p = sample[s];
+          double y[3] = {0.0, 0.0, 0.0};
+          for (int c = 0; c < 3; c++) {
+            const double *v = basis.data() + std::size_t(c) * dimension;
+            for (int d = 0; d < dimension; d++) y[c] += (p[d] - mean[d]) * v[d];
+          }
+          for (int c = 0; c < 3; c++) {
+            double *a = acc.data() + std::size_t(c) * dimension;
+            for (int d = 0; d < dimension; d++) a[d] += y[c] * (p[d] - mean[d]);
+          }
+        }
+      });
+      std::fill(basis.begin(), basis.end(), 0.0);
+      for (const std::vector<double> &acc : partials) {
+        for (std::size_t i = 0; i < acc.size(); i++) basis[i] += acc[i];
+      }
+      orthonormalize(basis, dimension, engine);
+    }
+  }
+  setAxes(mean, basis);
+}
+
+void Projection::fit(const SparsePoints &points, Method method, unsigned seed)
+{
+  const int count = points.count();
+  const int dimension = points.dimension();
+  m_dimension = dimension;
+  std::default_random_engine engine(seed);
+  std::normal_distribution<double> distribution;
+  const int sampleSize = std::min(count, SampleSize);
+  std::vector<int> sample(sampleSize);
+  for (int s = 0; s < sampleSize; s++) {
+    sample[s] = int((long long)s * count / sampleSize);
+  }
+  std::vector<double> mean(dimension, 0.0);
+  for (int i : sample) {
+    const int *columns = points.columns(i);
+    const float *values = points.values(i);
+    for (int n = 0; n < points.size(i); n++) mean[columns[n]] += values[n];
+  }
+  for (double &value : mean) value /= std::max(1, sampleSize);
+  std::vector<double> basis(std::size_t(3) * dimension);
+  for (double &value : basis) value = distribution(engine);
+  orthonormalize(basis, dimension, engine);
+  if(method == PrincipalComponents){
+    //Same iteration as the dense fit with (p - mean) . v = p . v - mean . v,
+    //the mean part of the update is added once from the summed y
+    std::vector<std::vector<double> > partials(m_pool->threadCount());
+    for (int round = 0; round < PowerIterations; round++) {
+      double centered[3] = {0.0, 0.0, 0.0};
+      for (int c = 0; c < 3; c++) {
+        const double *v = basis.data() + std::size_t(c) * dimension;
+        for (int d = 0; d < dimension; d++) centered[c] += mean[d] * v[d];
+      }
+      m_pool->parallelFor(0, sampleSize, [&](int begin, int end, int chunk) {
+        std::vector<double> &acc = partials[chunk];
+        acc.assign(std::size_t(3) * dimension + 3, 0.0);
+        double *ySum = acc.data() + std::size_t(3) * dimension;
+        for (int s = begin; s < end; s++) {
+          const int *columns = points.columns(sample[s]);
+          const float *values = points.values(sample[s]);
+          const int size = points.size(sample[s]);
+          for (int c = 0; c < 3; c++) {
+            const double *v = basis.data() + std::size_t(c) * dimension;
+            double y = -centered[c];
+            for (int n = 0; n < size; n++) y += values[n] * v[columns[n]];
+            double *a = acc.data() + std::size_t(c) * dimension;
+            for (int n = 0; n < size; n++) a[columns[n]] += y * values[n];
+            ySum[c] += y;
+          }
+        }
+      });
+      std::fill(basis.begin(), basis.end(), 0.0);
+      double ySum[3] = {0.0, 0.0, 0.0};
+      for (const std::vector<double> &acc : partials) {
+        if(acc.empty()) continue;
+        for (std::size_t i = 0; i < basis.size(); i++) basis[i] += acc[i];
+        for (int c = 0; c < 3; c++) ySum[c] += acc[basis.size() + c];
+      }
+      for (int c = 0; c < 3; c++) {
+        double *v = basis.data() + std::size_t(c) * dimension;
+        for (int d = 0; d < dimension; d++) v[d] -= ySum[c] * mean[d];
+      }
+      orthonormalize(basis, dimension, engine);
+    }
+  }
+  setAxes(mean, basis);
+}
+
+void Projection::setAxes(const std::vector<double> &mean, const std::vector<double> &basis)
+{
+  const int dimension = m_dimension;
+  m_mean.assign(mean.begin(), mean.end());
+  m_axes.assign(basis.begin(), basis.end());
+  for (int c = 0; c < 3; c++) {
+    double offset = 0.0;
+    for (int d = 0; d < dimension; d++) offset += basis[std::size_t(c) * dimension + d] * mean[d];
+    m_offset[c] = float(offset);
+  }
+}
+
+void Projection::project(const float *points, int count, float *out)
+{
+  const int dimension = m_dimension;
+  const float *x = m_axes.data();
+  const float *y = x + dimension;
+  const float *z = y + dimension;
+  //Blocks of points per task, three dot products share each point load
+  const int blockSize = 1024;
+  const int blocks = (count + blockSize - 1) / blockSize;
+  m_pool->parallelFor(0, blocks, [&](int begin, int end, int) {
+    const int last = std::min(count, end * blockSize);
+    for (int i = begin * blockSize; i < last; i++) {
+      const float *p = points + std::size_t(i) * dimension;
+      float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+      for (int d = 0; d < dimension; d++) {
+        sx += x[d] * p[d];
+        sy += y[d] * p[d];
+        sz += z[d] * p[d];
+      }
+      out[std::size_t(i) * 3] = sx - m_offset[0];
+      out[std::size_t(i) * 3 + 1] = sy - m_offset[1];
+      out[std::size_t(i) * 3 + 2] = sz - m_offset[2];
+    }
+  });
+}
+
+void Projection::project(const SparsePoints &points, float *out)
+{
+  const int count = points.count();
+  const float *x = m_axes.data();
+  const float *y = x + m_dimension;
+  const float *z = y + m_dimension;
+  const int blockSize = 1024;
+  const int blocks = (count + blockSize - 1) / blockSize;
+  m_pool->parallelFor(0, blocks, [&](int begin, int end, int) {
+    const int last = std::min(count, end * blockSize);
+    for (int i = begin * blockSize; i < last; i++) {
+      const int *columns = points.columns(i);
+      const float *values = points.values(i);
+      float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+      for (int n = 0; n < points.size(i); n++) {
+        sx += x[columns[n]] * values[n];
+        sy += y[columns[n]] * values[n];
+        sz += z[columns[n]] * values[n];
+      }
+      out[std::size_t(i) * 3] = sx - m_offset[0];
+      out[std::size_t(i) * 3 + 1] = sy - m_offset[1];
+      out[std::size_t(i) * 3 + 2] = sz - m_offset[2];
+    }
+  });
+}
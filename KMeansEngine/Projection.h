@@ -0,0 +1,49 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include "ThreadPool.h"
+#include <memory>
+#include <vector>
+
+class SparsePoints;
+
+// Linear map from D dimensions to 3 for drawing. Principal components are
+// found by randomized subspace iteration on a strided sample (no D x D
+// covariance is formed); the Gaussian variant just orthonormalizes random
+// directions. Once fitted, project() maps points or centroids with one
+// blocked parallel pass, out[i * 3 + c] = axis c . (point i - mean).
+// Sparse points are fitted and projected over their nonzeros, the mean is
+// taken out of the dot products instead of densifying the rows.
+class Projection
+{
+public:
+  enum Method {
+    PrincipalComponents = 0,
+    RandomGaussian = 1
+  };
+
+  // Uses its own pool so it can run next to a busy engine
+  explicit Projection(int threadCount = 0);
+
+  void fit(const float *points, int count, int dimension, Method method, unsigned seed = 1);
+  void project(const float *points, int count, float *out);
+  void fit(const SparsePoints &points, Method method, unsigned seed = 1);
+  void project(const SparsePoints &points, float *out);
+  int dimension() const { return m_dimension; }
+  // Axis c is axes()[c * dimension() .. (c + 1) * dimension())
+  const std::vector<float> &axes() const { return m_axes; }
+
+private:
+  void setAxes(const std::vector<double> &mean, const std::vector<double> &basis);
+
+  static constexpr int SampleSize = 20000;
+  static constexpr int PowerIterations = 8;
+  std::unique_ptr<ThreadPool> m_pool;
+  int m_dimension = 0;
+  std::vector<float> m_mean;
+  std::vector<float> m_axes;
+  // axes . mean, subtracted so projecting skips the centering
+  float m_offset[3] = {0.0f, 0.0f, 0.0f};
+};
+
+#endif // PROJECTION_H
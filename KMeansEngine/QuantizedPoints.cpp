@@ -0,0 +1,117 @@
+#include "QuantizedPoints.h"
+#include "DistanceKernels.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Round to nearest even like the F16C conversion, overflow goes to infinity
+std::uint16_t floatToHalf(float value)
+{
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const std::uint16_t sign = std::uint16_t((bits >> 16) & 0x8000);
+  const std::uint32_t magnitude = bits & 0x7fffffff;
+  if(magnitude >= 0x7f800000) return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+  //65520 and up round past the largest half
+  if(magnitude >= 0x477ff000) return sign | 0x7c00;
+  //Below 2^-14 the result is subnormal, counted in steps of 2^-24
+  if(magnitude < 0x38800000) return sign | std::uint16_t(std::nearbyint(std::fabs(value) * 16777216.0f));
+  std::uint32_t half = (magnitude >> 13) - (112 << 10);
+  const std::uint32_t rest = magnitude & 0x1fff;
+  if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+  return sign | std::uint16_t(half);
+}
+
+} // namespace
+
+void QuantizedPoints::build(const float *points, int count, int dimension, int format, ThreadPool &pool)
+{
+  clear();
+  m_format = format;
+  m_count = count;
+  m_dimension = dimension;
+  const std::size_t size = std::size_t(count) * dimension;
+  if(format == Int8){
+    //Per-dimension range, one partial per chunk
+    const int threads = pool.threadCount();
+    std::vector<float> low(std::size_t(threads) * dimension, std::numeric_limits<float>::max());
+    std::vector<float> high(std::size_t(threads) * dimension, -std::numeric_limits<float>::max());
+    pool.parallelFor(0, count, [&](int begin, int end, int chunk) {
+      float *l = low.data() + std::size_t(chunk) * dimension;
+      float *h = high.data() + std::size_t(chunk) * dimension;
+      for (int i = begin; i < end; i++) {
+        const float *p = points + std::size_t(i) * dimension;
+        for (int d = 0; d < dimension; d++) {
+          l[d] = std::min(l[d], p[d]);
+          h[d] = std::max(h[d], p[d]);
+        }
+      }
+    });
+    m_scale.resize(dimension);
+    m_offset.resize(dimension);
+    for (int d = 0; d < dimension; d++) {
+      float l = low[d];
+      float h = high[d];
+      for (int t = 1; t < threads; t++) {
+        l = std::min(l, low[std::size_t(t) * dimension + d]);
+        h = std::max(h, high[std::size_t(t) * dimension + d]);
+      }
+      m_offset[d] = 0.5f * (l + h);
+      m_scale[d] = (h - l) / 254.0f;
+    }
+    m_bytes.resize(size);
+  }else{
+    m_half.resize(size);
+  }
+  m_errors.resize(count);
+  pool.parallelFor(0, count, [&](int begin, int end, int) {
+    std::vector<float> decoded(dimension);
+    for (int i = begin; i < end; i++) {
+      const float *p = points + std::size_t(i) * dimension;
+      if(format == Int8){
+        std::int8_t *q = m_bytes.data() + std::size_t(i) * dimension;
+        for (int d = 0; d < dimension; d++) {
+          const float steps = m_scale[d] > 0.0f ? (p[d] - m_offset[d]) / m_scale[d] : 0.0f;
+          q[d] = std::int8_t(std::max(-127.0f, std::min(127.0f, std::nearbyint(steps))));
+        }
+      }else{
+        std::uint16_t *h = m_half.data() + std::size_t(i) * dimension;
+        for (int d = 0; d < dimension; d++) h[d] = floatToHalf(p[d]);
+      }
+      //Measured on what the kernels will see, not on the format's worst case
+      decode(i, decoded.data());
+      double error = 0.0;
+      for (int d = 0; d < dimension; d++) error += double(decoded[d] - p[d]) * (decoded[d] - p[d]);
+      m_errors[i] = float(std::sqrt(error));
+    }
+  });
+}
+
+void QuantizedPoints::clear()
+{
+  m_count = 0;
+  m_half = std::vector<std::uint16_t>();
+  m_bytes = std::vector<std::int8_t>();
+  m_scale.clear();
+  m_offset.clear();
+  m_errors = std::vector<float>();
+}
+
+std::size_t QuantizedPoints::bytes() const
+{
+  return m_half.size() * sizeof(std::uint16_t) + m_bytes.size() + (m_scale.size() + m_offset.size() + m_errors.size()) * sizeof(float);
+}
+
+void QuantizedPoints::decode(int index, float *out) const
+{
+  const std::size_t row = std::size_t(index) * m_dimension;
+  if(m_format == Int8){
+    DistanceKernels::decodeInt8(m_bytes.data() + row, m_scale.data(), m_offset.data(), m_dimension, out);
+  }else{
+    DistanceKernels::decodeHalf(m_half.data() + row, m_dimension, out);
+  }
+}
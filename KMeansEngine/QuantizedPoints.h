@@ -0,0 +1,45 @@
+#ifndef QUANTIZEDPOINTS_H
+#define QUANTIZEDPOINTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Compressed copy of the points for the memory bound assignment pass.
+// Float16 stores IEEE half precision values (2 bytes per coordinate),
+// Int8 stores round((x - offset[d]) / scale[d]) in [-127, 127] with the
+// range of every dimension mapped separately (1 byte per coordinate). Rows
+// are expanded into a small float buffer right before the distance kernel.
+// The distance between every point and its decoded value is kept so
+// callers can tell when the compression could change a nearest centroid.
+class QuantizedPoints
+{
+public:
+  enum Format {
+    Float16 = 1,
+    Int8 = 2
+  };
+
+  void build(const float *points, int count, int dimension, int format, ThreadPool &pool);
+  void clear();
+  bool isEmpty() const { return m_count == 0; }
+  int format() const { return m_format; }
+  std::size_t bytes() const;
+  // Writes point index as floats to out[0 .. dimension)
+  void decode(int index, float *out) const;
+  float error(int index) const { return m_errors[index]; }
+
+private:
+  int m_format = Float16;
+  int m_count = 0;
+  int m_dimension = 0;
+  std::vector<std::uint16_t> m_half;
+  std::vector<std::int8_t> m_bytes;
+  std::vector<float> m_scale;
+  std::vector<float> m_offset;
+  std::vector<float> m_errors;
+};
+
+#endif // QUANTIZEDPOINTS_H
@@ -0,0 +1,57 @@
+#include "SparsePoints.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+void SparsePoints::assign(int dimension, std::vector<std::size_t> &&offsets, std::vector<int> &&columns,
+                          std::vector<float> &&values, ThreadPool &pool)
+{
+  m_dimension = dimension;
+  m_offsets = std::move(offsets);
+  m_columns = std::move(columns);
+  m_values = std::move(values);
+  m_norms.resize(count());
+  pool.parallelFor(0, count(), [&](int begin, int end, int) {
+    for (int i = begin; i < end; i++) {
+      const float *v = m_values.data() + m_offsets[i];
+      double norm = 0.0;
+      for (int n = 0; n < size(i); n++) norm += double(v[n]) * v[n];
+      m_norms[i] = float(norm);
+    }
+  });
+}
+
+void SparsePoints::clear()
+{
+  m_dimension = 0;
+  m_offsets = std::vector<std::size_t>();
+  m_columns = std::vector<int>();
+  m_values = std::vector<float>();
+  m_norms = std::vector<float>();
+}
+
+std::size_t SparsePoints::bytes() const
+{
+  return m_offsets.size() * sizeof(std::size_t) + m_columns.size() * sizeof(int)
+      + (m_values.size() + m_norms.size()) * sizeof(float);
+}
+
+void SparsePoints::toDense(int index, float *out) const
+{
+  std::fill(out, out + m_dimension, 0.0f);
+  const int *c = columns(index);
+  const float *v = values(index);
+  for (int n = 0; n < size(index); n++) out[c[n]] = v[n];
+}
+
+float SparsePoints::squaredDistance(int index, const float *centroid, float centroidNorm) const
+{
+  const int *c = columns(index);
+  const float *v = values(index);
+  //The zero coordinates contribute |centroid|^2 minus the nonzero columns
+  double distance = centroidNorm;
+  for (int n = 0; n < size(index); n++) {
+    const double z = centroid[c[n]];
+    distance += (v[n] - z) * (v[n] - z) - z * z;
+  }
+  return float(std::max(0.0, distance));
+}
@@ -0,0 +1,45 @@
+#ifndef SPARSEPOINTS_H
+#define SPARSEPOINTS_H
+
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+// Points in compressed sparse row (CSR) form for high dimensional data with
+// few nonzeros (bag of words, feature hashing). Row i holds the entries
+// [offset(i), offset(i + 1)) of the column and value arrays, with
+// increasing columns. The squared norm of every row is kept for the
+// sparse-dense distance kernel, |x - c|^2 = |x|^2 - 2 x.c + |c|^2.
+class SparsePoints
+{
+public:
+  // Takes the CSR arrays, offsets has count + 1 entries starting at 0
+  void assign(int dimension, std::vector<std::size_t> &&offsets, std::vector<int> &&columns,
+              std::vector<float> &&values, ThreadPool &pool);
+  void clear();
+  bool isEmpty() const { return count() == 0; }
+  int count() const { return m_offsets.empty() ? 0 : int(m_offsets.size() - 1); }
+  int dimension() const { return m_dimension; }
+  std::size_t nonZeros() const { return m_values.size(); }
+  std::size_t bytes() const;
+
+  int size(int index) const { return int(m_offsets[index + 1] - m_offsets[index]); }
+  const int *columns(int index) const { return m_columns.data() + m_offsets[index]; }
+  const float *values(int index) const { return m_values.data() + m_offsets[index]; }
+  float squaredNorm(int index) const { return m_norms[index]; }
+  // Writes point index as dimension floats
+  void toDense(int index, float *out) const;
+  // |point index - centroid|^2 in double over the nonzeros, centroidNorm
+  // is |centroid|^2 and stands in for the zero coordinates
+  float squaredDistance(int index, const float *centroid, float centroidNorm) const;
+
+private:
+  int m_dimension = 0;
+  std::vector<std::size_t> m_offsets;
+  std::vector<int> m_columns;
+  std::vector<float> m_values;
+  std::vector<float> m_norms;
+};
+
+#endif // SPARSEPOINTS_H
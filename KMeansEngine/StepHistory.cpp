@@ -0,0 +1,174 @@
+#include "StepHistory.h"
+#include <algorithm>
+
+std::size_t StepHistory::Entry::bytes() const
+{
+  return sizeof(Entry) + (centroids.size() + changed.size() + flips.size()) * sizeof(int);
+}
+
+void StepHistory::setCapacity(int steps, std::size_t bytes)
+{
+  m_maxSteps = std::max(0, steps);
+  if(m_maxSteps == 0) clear();
+  m_maxBytes = bytes;
+  trim();
+}
+
+void StepHistory::clear()
+{
+  m_entries.clear();
+  m_labels.clear();
+  m_position = -1;
+  m_bytes = 0;
+}
+
+void StepHistory::reset(const int *labels, int count, const float *centroids, int centroidSize, int iteration, float energy)
+{
+  clear();
+  if(m_maxSteps == 0) return;
+  m_labels.assign(labels, labels + count);
+  Entry entry;
+  entry.iteration = iteration;
+  entry.energy = energy;
+  entry.centroids.assign(centroids, centroids + centroidSize);
+  m_bytes = entry.bytes();
+  m_entries.push_back(std::move(entry));
+  m_position = 0;
+}
+
+void StepHistory::record(const int *labels, const float *centroids, int iteration, float energy,
+                         const int *indices, int indexCount)
+{
+  if(m_position < 0) return;
+  //A new step replaces whatever could have been redone
+  while(canForward()){
+    m_bytes -= m_entries.back().bytes();
+    m_entries.pop_back();
+  }
+  Entry entry;
+  entry.iteration = iteration;
+  entry.energy = energy;
+  entry.centroids.assign(centroids, centroids + m_entries.back().centroids.size());
+  const int count = int(m_labels.size());
+  const int candidates = indices ? indexCount : count;
+  for (int n = 0; n < candidates; n++) {
+    const int i = indices ? indices[n] : n;
+    if(labels[i] == m_labels[i]) continue;
+    //Past half the points a dense delta is smaller than index + flip pairs
+    if(int(entry.changed.size()) * 2 >= count){
+      entry.changed.clear();
+      entry.flips.resize(count);
+      for (int j = 0; j < count; j++) entry.flips[j] = labels[j] ^ m_labels[j];
+      break;
+    }
+    entry.changed.push_back(i);
+    entry.flips.push_back(labels[i] ^ m_labels[i]);
+  }
+  if(indices && !entry.changed.empty()){
+    for (int i : entry.changed) m_labels[i] = labels[i];
+  }else if(!indices || !entry.flips.empty()){
+    std::copy(labels, labels + count, m_labels.begin());
+  }
+  m_bytes += entry.bytes();
+  m_entries.push_back(std::move(entry));
+  m_position++;
+  trim();
+}
+
+void StepHistory::relabel(const int *labels)
+{
+  if(m_position < 0) return;
+  const int count = int(m_labels.size());
+  std::vector<int> change(count);
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    change[i] = labels[i] ^ m_labels[i];
+    if(change[i]) changed = true;
+  }
+  if(!changed) return;
+  //The oldest entry has no delta, it is just the base labels
+  if(m_position > 0) addFlips(m_entries[m_position], change);
+  if(canForward()) addFlips(m_entries[m_position + 1], change);
+  std::copy(labels, labels + count, m_labels.begin());
+  trim();
+}
+
+//XORs a per-point change into the entry's delta and re-encodes it
+void StepHistory::addFlips(Entry &entry, const std::vector<int> &change)
+{
+  m_bytes -= entry.bytes();
+  std::vector<int> flips(change);
+  if(entry.changed.empty()){
+    for (std::size_t i = 0; i < entry.flips.size(); i++) flips[i] ^= entry.flips[i];
+  }else{
+    for (std::size_t n = 0; n < entry.changed.size(); n++) flips[entry.changed[n]] ^= entry.flips[n];
+  }
+  entry.changed.clear();
+  entry.flips.clear();
+  const int count = int(flips.size());
+  const int changes = int(std::count_if(flips.begin(), flips.end(), [](int flip) { return flip != 0; }));
+  if(changes * 2 >= count){
+    entry.flips.swap(flips);
+  }else if(changes > 0){
+    for (int i = 0; i < count; i++) {
+      if(!flips[i]) continue;
+      entry.changed.push_back(i);
+      entry.flips.push_back(flips[i]);
+    }
+  }
+  m_bytes += entry.bytes();
+}
+
+void StepHistory::apply(const Entry &entry, int *labels)
+{
+  if(entry.changed.empty()){
+    for (std::size_t i = 0; i < entry.flips.size(); i++) {
+      labels[i] ^= entry.flips[i];
+      m_labels[i] ^= entry.flips[i];
+    }
+    return;
+  }
+  for (std::size_t n = 0; n < entry.changed.size(); n++) {
+    const int i = entry.changed[n];
+    labels[i] ^= entry.flips[n];
+    m_labels[i] ^= entry.flips[n];
+  }
+}
+
+bool StepHistory::back(int *labels)
+{
+  if(!canBack()) return false;
+  apply(m_entries[m_position], labels);
+  m_position--;
+  return true;
+}
+
+bool StepHistory::forward(int *labels)
+{
+  if(!canForward()) return false;
+  m_position++;
+  apply(m_entries[m_position], labels);
+  return true;
+}
+
+StepHistory::State StepHistory::current() const
+{
+  const Entry &entry = m_entries[m_position];
+  State state = {entry.iteration, entry.energy, entry.centroids.data()};
+  return state;
+}
+
+//The oldest entry becomes the base, its delta is no longer needed
+void StepHistory::trim()
+{
+  while(m_entries.size() > 1 && m_position > 0 && (int(m_entries.size()) > m_maxSteps || m_bytes > m_maxBytes)){
+    m_bytes -= m_entries.front().bytes();
+    m_entries.pop_front();
+    m_position--;
+    Entry &base = m_entries.front();
+    m_bytes -= base.bytes();
+    std::vector<int>().swap(base.changed);
+    std::vector<int>().swap(base.flips);
+    m_bytes += base.bytes();
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef STEPHISTORY_H
+#define STEPHISTORY_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+// Bounded undo/redo history of clustering steps. Every entry keeps the
+// centroids after the step and the labels that changed, XOR encoded so the
+// same delta moves the labels either way. Sparse deltas store point index
+// and flip; when most points changed a dense flip array is smaller. The
+// oldest entries are dropped once the step count or byte budget is hit.
+class StepHistory
+{
+public:
+  struct State
+  {
+    int iteration;
+    float energy;
+    const float *centroids;
+  };
+
+  // steps = 0 turns recording off
+  void setCapacity(int steps, std::size_t bytes);
+  void clear();
+  // Starts over from the given state as the only entry
+  void reset(const int *labels, int count, const float *centroids, int centroidSize, int iteration, float energy);
+  // Appends the state after a step, dropping any entries ahead of the
+  // current one. indices limits the comparison to the points the step
+  // could relabel (e.g. a mini-batch), null compares all of them.
+  void record(const int *labels, const float *centroids, int iteration, float energy,
+              const int *indices = nullptr, int indexCount = 0);
+  // Replaces the labels of the current entry (a relabel without a step,
+  // e.g. a full assignment after mini-batch). The neighbouring deltas are
+  // patched so back() and forward() still reach the recorded labels.
+  void relabel(const int *labels);
+  bool canBack() const { return m_position > 0; }
+  bool canForward() const { return m_position + 1 < int(m_entries.size()); }
+  // Move one entry, updating labels in place; false at either end
+  bool back(int *labels);
+  bool forward(int *labels);
+  State current() const;
+  int size() const { return int(m_entries.size()); }
+  std::size_t bytes() const { return m_bytes; }
+
+private:
+  struct Entry
+  {
+    int iteration = 0;
+    float energy = 0.0f;
+    std::vector<float> centroids;
+    // Sparse: flips[n] applies to point changed[n]; dense: changed is empty
+    // and flips holds one value per point (or nothing for the oldest entry)
+    std::vector<int> changed;
+    std::vector<int> flips;
+    std::size_t bytes() const;
+  };
+  void apply(const Entry &entry, int *labels);
+  void addFlips(Entry &entry, const std::vector<int> &change);
+  void trim();
+
+  int m_maxSteps = 1000;
+  std::size_t m_maxBytes = std::size_t(256) << 20;
+  std::deque<Entry> m_entries;
+  int m_position = -1;
+  std::size_t m_bytes = 0;
+  // Labels of the current entry, the base for the next delta
+  std::vector<int> m_labels;
+};
+
+#endif // STEPHISTORY_H
@@ -0,0 +1,263 @@
+#include "StreamingKMeans.h"
+#include "BinaryFormat.h"
+#include "DistanceKernels.h"
+#include "KMeansEngine.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+
+StreamingKMeans::StreamingKMeans()
+  : m_pool(new ThreadPool())
+{
+}
+
+StreamingKMeans::~StreamingKMeans()
+{
+  close();
+}
+
+void StreamingKMeans::setThreadCount(int count)
+{
+  if(count < 1) count = ThreadPool::defaultThreadCount();
+  if(count != m_pool->threadCount()) m_pool.reset(new ThreadPool(count));
+}
+
+void StreamingKMeans::setBlockBytes(std::size_t bytes)
+{
+  m_blockBytes = std::max<std::size_t>(bytes, 1);
+}
+
+bool StreamingKMeans::open(const std::string &path, std::string &error)
+{
+  close();
+  //Mapping only reserves address space, just the header pages are read
+  MappedFile file;
+  if(!file.open(path)){
+    error = "Cannot open " + path;
+    return false;
+  }
+  BinaryFormat::Layout layout;
+  bool parsed = BinaryFormat::isNpy(file.data(), file.size()) ? BinaryFormat::parseNpy(file.data(), file.size(), layout, error)
+                                                              : BinaryFormat::parseNative(file.data(), file.size(), layout, error);
+  if(!parsed) return false;
+  if(layout.dtype != BinaryFormat::Float32 || layout.fortranOrder){
+    error = "Streaming needs row-major float32 data";
+    return false;
+  }
+  m_path = path;
+  m_dataOffset = layout.dataOffset;
+  m_pointCount = layout.count;
+  m_dimension = layout.dimension;
+  return true;
+}
+
+void StreamingKMeans::close()
+{
+  if(m_labelFile) std::fclose(m_labelFile);
+  m_labelFile = nullptr;
+  m_path.clear();
+  m_pointCount = 0;
+  m_K = 0;
+  m_iteration = 0;
+  m_energy = 0.0;
+  m_centroids.clear();
+  m_blocks[0] = AlignedBuffer<float>();
+  m_blocks[1] = AlignedBuffer<float>();
+}
+
+int StreamingKMeans::blockPoints() const
+{
+  const std::size_t pointBytes = std::size_t(m_dimension) * sizeof(float);
+  return int(std::max<std::size_t>(1, std::min<std::size_t>(m_blockBytes / pointBytes, 0x7fffffff)));
+}
+
+// Chunks follow the block size, not the threads, within a memory budget
+// for large K x D
+int StreamingKMeans::reductionChunks() const
+{
+  const long long points = std::min<long long>(blockPoints(), m_pointCount);
+  const std::size_t row = std::size_t(m_K) * m_dimension * sizeof(double);
+  const std::size_t budget = std::max<std::size_t>(1, ReductionBytes / std::max<std::size_t>(row, 1));
+  const int chunks = int(std::min<long long>(MaxReductionChunks, std::max<long long>(1, points / MinChunkPoints)));
+  return int(std::min<std::size_t>(chunks, budget));
+}
+
+// Streams every point once, calling fn on each block in file order while
+// the following block is being read
+bool StreamingKMeans::scan(const BlockFunction &fn)
+{
+  std::FILE *file = BinaryFormat::openFile(m_path, "rb");
+  if(!file || std::fseek(file, long(m_dataOffset), SEEK_SET) != 0){
+    if(file) std::fclose(file);
+    m_error = "Cannot read " + m_path;
+    return false;
+  }
+  const std::size_t pointBytes = std::size_t(m_dimension) * sizeof(float);
+  const int blockSize = blockPoints();
+  for (AlignedBuffer<float> &block : m_blocks) block.resize(std::size_t(blockSize) * m_dimension);
+  auto read = [&](int buffer, int count) {
+    return std::async(std::launch::async, [=]() {
+      return std::fread(m_blocks[buffer].data(), pointBytes, std::size_t(count), file);
+    });
+  };
+  long long first = 0;
+  int current = 0;
+  int count = int(std::min<long long>(blockSize, m_pointCount));
+  std::future<std::size_t> pending = read(current, count);
+  bool ok = true;
+  while(first < m_pointCount){
+    if(pending.get() != std::size_t(count)){
+      m_error = "Unexpected end of " + m_path;
+      ok = false;
+      break;
+    }
+    const long long next = first + count;
+    const int nextCount = int(std::min<long long>(blockSize, m_pointCount - next));
+    if(nextCount > 0) pending = read(1 - current, nextCount);
+    fn(m_blocks[current].data(), count, first);
+    //fn may have failed, the read in flight still has to finish first
+    if(!m_error.empty()){
+      if(nextCount > 0) pending.wait();
+      ok = false;
+      break;
+    }
+    first = next;
+    count = nextCount;
+    current = 1 - current;
+  }
+  std::fclose(file);
+  return ok;
+}
+
+bool StreamingKMeans::initialize(int k, int mode, const std::string &labelPath, std::string &error)
+{
+  m_error.clear();
+  if(m_pointCount == 0 || k < 2 || k > m_pointCount){
+    error = "Invalid K number";
+    return false;
+  }
+  //Sample large enough for the seeding, capped at 256 MB
+  const std::size_t pointBytes = std::size_t(m_dimension) * sizeof(float);
+  long long sampleSize = std::max<long long>(64LL * k, MinSampleSize);
+  sampleSize = std::min<long long>(sampleSize, std::max<long long>(k, (256LL << 20) / pointBytes));
+  sampleSize = std::min<long long>(sampleSize, m_pointCount);
+  std::vector<float> sample(std::size_t(sampleSize) * m_dimension);
+  long long taken = 0;
+  bool ok = scan([&](const float *block, int count, long long first) {
+    //Point j of the sample is point floor(j * N / S) of the file
+    while(taken < sampleSize){
+      long long index = (long long)((double)taken * m_pointCount / sampleSize);
+      if(index >= first + count) break;
+      std::copy(block + std::size_t(index - first) * m_dimension, block + std::size_t(index - first + 1) * m_dimension,
+                sample.begin() + std::size_t(taken) * m_dimension);
+      taken++;
+    }
+  });
+  if(!ok){
+    error = m_error;
+    return false;
+  }
+  KMeansEngine seeding;
+  seeding.setThreadCount(m_pool->threadCount());
+  seeding.setSeed(m_seed);
+  seeding.setPoints(sample.data(), int(sampleSize), m_dimension);
+  if(!seeding.initialize(k, mode)){
+    error = "Invalid K number";
+    return false;
+  }
+  m_K = k;
+  m_centroids.assign(seeding.centroids(), seeding.centroids() + std::size_t(k) * m_dimension);
+  if(m_labelFile) std::fclose(m_labelFile);
+  m_labelFile = BinaryFormat::openFile(labelPath, "w+b");
+  if(!m_labelFile){
+    m_K = 0;
+    error = "Cannot write " + labelPath;
+    return false;
+  }
+  m_iteration = 0;
+  m_energy = 0.0;
+  return true;
+}
+
+void StreamingKMeans::assignBlock(const float *block, int count, long long first)
+{
+  const bool wide = wideLabels();
+  m_labels.resize(std::size_t(count) * (wide ? sizeof(std::uint32_t) : sizeof(std::uint16_t)));
+  m_pool->parallelFor(0, count, int(m_partials.size()), [&](int begin, int end, int chunk) {
+    ChunkAccumulator &acc = m_partials[chunk];
+    std::vector<float> distances(m_stride);
+    for (int i = begin; i < end; i++) {
+      const float *p = block + std::size_t(i) * m_dimension;
+      DistanceKernels::squaredDistances(p, m_packed.data(), m_dimension, m_stride, distances.data());
+      float min = distances[0];
+      int label = 0;
+      for (int j = 1; j < m_K; j++) {
+        if(distances[j] < min){
+          min = distances[j];
+          label = j;
+        }else if(distances[j] == min && KMeansEngine::takeTie(m_seed, first + i, m_iteration, j)){
+          label = j;
+        }
+      }
+      if(wide){
+        reinterpret_cast<std::uint32_t *>(m_labels.data())[i] = std::uint32_t(label);
+      }else{
+        reinterpret_cast<std::uint16_t *>(m_labels.data())[i] = std::uint16_t(label);
+      }
+      acc.add(p, m_dimension, label, std::sqrt(min));
+    }
+    acc.evaluations += (long long)(end - begin) * m_K;
+  });
+}
+
+bool StreamingKMeans::step()
+{
+  if(!isInitialized() || !m_error.empty()) return false;
+  m_stride = DistanceKernels::paddedStride(m_K);
+  m_packed.resize(std::size_t(m_stride) * m_dimension);
+  DistanceKernels::pack(m_centroids.data(), m_K, m_dimension, m_stride, m_packed.data());
+  //Sums accumulate over the whole pass, chunk c of every block into the
+  //same partial
+  m_partials.resize(reductionChunks());
+  for (ChunkAccumulator &acc : m_partials) acc.reset(m_K, m_dimension);
+  std::rewind(m_labelFile);
+  bool ok = scan([&](const float *block, int count, long long first) {
+    assignBlock(block, count, first);
+    if(std::fwrite(m_labels.data(), 1, m_labels.size(), m_labelFile) != m_labels.size()){
+      m_error = "Writing the label file failed";
+    }
+  });
+  if(!ok || std::fflush(m_labelFile) != 0){
+    if(m_error.empty()) m_error = "Writing the label file failed";
+    return false;
+  }
+  ChunkAccumulator &total = m_partials[0];
+  for (std::size_t t = 1; t < m_partials.size(); t++) total.merge(m_partials[t]);
+  m_energy = total.energy;
+  bool moved = false;
+  for (int i = 0; i < m_K; i++) {
+    //Empty clusters keep their previous position
+    if(total.counts[i] == 0) continue;
+    float *c = m_centroids.data() + std::size_t(i) * m_dimension;
+    const double *s = total.sums.data() + std::size_t(i) * m_dimension;
+    for (int d = 0; d < m_dimension; d++) {
+      float mean = float(s[d] / total.counts[i]);
+      if(mean != c[d]){
+        c[d] = mean;
+        moved = true;
+      }
+    }
+  }
+  m_iteration += 1;
+  return moved;
+}
+
+bool StreamingKMeans::run(int maxIterations)
+{
+  while(m_iteration < maxIterations){
+    if(!step()) return isInitialized() && m_error.empty();
+  }
+  return false;
+}
@@ -0,0 +1,95 @@
+#ifndef STREAMINGKMEANS_H
+#define STREAMINGKMEANS_H
+
+#include "AlignedBuffer.h"
+#include "ChunkAccumulator.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Lloyd iterations over a binary point file larger than memory (float32
+// row-major .kmb or .npy, see BinaryFormat.h). Every step streams the file
+// in fixed-size blocks: the next block is read on a helper thread while the
+// pool assigns the current one, and the labels are appended to a label file
+// in point order (uint16 when K fits, otherwise uint32). Memory stays at two
+// blocks plus the centroids and the partial sums, whatever the file size.
+// The partial sums are split by the block size alone, so the centroids and
+// the energy do not depend on the thread count. Seeding and exact distance
+// ties use the same seeded draws as KMeansEngine: when one block holds the
+// whole file and the sample is every point, the result matches
+// KMeansEngine::run() with Lloyd's algorithm bit for bit.
+class StreamingKMeans
+{
+public:
+  StreamingKMeans();
+  ~StreamingKMeans();
+
+  void setThreadCount(int count);
+  // See KMeansEngine::setSeed()
+  void setSeed(std::uint64_t seed) { m_seed = seed; }
+  // Bytes per read block, rounded to whole points
+  void setBlockBytes(std::size_t bytes);
+
+  bool open(const std::string &path, std::string &error);
+  void close();
+  long long pointCount() const { return m_pointCount; }
+  int dimension() const { return m_dimension; }
+
+  // Seeds with an in-memory KMeansEngine init (mode is a
+  // KMeansEngine::InitMode) on an evenly strided sample read in one pass,
+  // and creates the label file. The sample holds max(64 K, MinSampleSize)
+  // points, capped at 256 MB.
+  static constexpr long long MinSampleSize = 65536;
+  bool initialize(int k, int mode, const std::string &labelPath, std::string &error);
+  // One streamed Lloyd pass, returns whether the centroids moved. I/O
+  // failures stop the run and are reported by error().
+  bool step();
+  // True once converged, false at maxIterations or on error
+  bool run(int maxIterations);
+
+  bool isInitialized() const { return m_K > 1 && m_labelFile; }
+  int clusterCount() const { return m_K; }
+  int iteration() const { return m_iteration; }
+  double energy() const { return m_energy; }
+  const std::vector<float> &centroids() const { return m_centroids; }
+  bool wideLabels() const { return m_K > 0xFFFF; }
+  const std::string &error() const { return m_error; }
+
+private:
+  typedef std::function<void(const float *block, int count, long long first)> BlockFunction;
+  int blockPoints() const;
+  int reductionChunks() const;
+  bool scan(const BlockFunction &fn);
+  void assignBlock(const float *block, int count, long long first);
+
+  std::unique_ptr<ThreadPool> m_pool;
+  std::uint64_t m_seed = 0;
+  std::size_t m_blockBytes = std::size_t(64) << 20;
+  std::string m_path;
+  std::size_t m_dataOffset = 0;
+  long long m_pointCount = 0;
+  int m_dimension = 0;
+  int m_K = 0;
+  int m_iteration = 0;
+  double m_energy = 0.0;
+  std::vector<float> m_centroids;
+  AlignedBuffer<float> m_packed;
+  int m_stride = 0;
+  // Double-buffered point blocks and the labels of the current block
+  AlignedBuffer<float> m_blocks[2];
+  std::vector<unsigned char> m_labels;
+  std::FILE *m_labelFile = nullptr;
+  // Partial sums per chunk of a block, kept over the whole pass and added
+  // in chunk order, as in KMeansEngine
+  static constexpr int MinChunkPoints = 1024;
+  static constexpr int MaxReductionChunks = 64;
+  static constexpr std::size_t ReductionBytes = std::size_t(256) << 20;
+  std::vector<ChunkAccumulator> m_partials;
+  std::string m_error;
+};
+
+#endif // STREAMINGKMEANS_H
@@ -0,0 +1,313 @@
+#include "TextLoader.h"
+#include "SparsePoints.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace
+{
+
+inline bool isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char *skipBlanks(const char *p, const char *end)
+{
+  while(p < end && isBlank(*p)) p++;
+  return p;
+}
+
+inline const char *lineEnd(const char *p, const char *end)
+{
+  const char *newline = static_cast<const char *>(std::memchr(p, '\n', std::size_t(end - p)));
+  return newline ? newline : end;
+}
+
+// Reads one integer header line starting at p, returns the next line
+const char *headerLine(const char *p, const char *end, int &value)
+{
+  const char *stop = lineEnd(p, end);
+  p = skipBlanks(p, stop);
+  std::from_chars_result result = std::from_chars(p, stop, value);
+  if(result.ec != std::errc() || skipBlanks(result.ptr, stop) != stop) return nullptr;
+  return stop < end ? stop + 1 : end;
+}
+
+// std::from_chars rejects a leading '+', QString::toFloat (and %+f output)
+// does not, so a single one is skipped
+inline std::from_chars_result parseFloat(const char *p, const char *end, float &value)
+{
+  if(p + 1 < end && *p == '+' && p[1] != '-') p++;
+  return std::from_chars(p, end, value);
+}
+
+// End of the line's content, before any '#' comment
+inline const char *contentEnd(const char *p, const char *stop)
+{
+  const char *comment = static_cast<const char *>(std::memchr(p, '#', std::size_t(stop - p)));
+  return comment ? comment : stop;
+}
+
+inline const char *tokenEnd(const char *p, const char *end)
+{
+  while(p < end && !isBlank(*p)) p++;
+  return p;
+}
+
+// SVMlight query ids (qid:N) look like pairs but are not features
+inline bool isQid(const char *p, const char *stop)
+{
+  return stop - p >= 4 && std::memcmp(p, "qid:", 4) == 0;
+}
+
+// Counts the index:value pairs and the other tokens of one row's content
+void countTokens(const char *p, const char *end, std::size_t &pairs, int &others)
+{
+  pairs = 0;
+  others = 0;
+  for (p = skipBlanks(p, end); p < end; p = skipBlanks(p, end)) {
+    const char *stop = tokenEnd(p, end);
+    if(std::memchr(p, ':', std::size_t(stop - p)) == nullptr) others++;
+    else if(!isQid(p, stop)) pairs++;
+    p = stop;
+  }
+}
+
+// Splits [data, data + size) into chunks at line boundaries, a few per
+// thread so uneven lines still balance
+std::vector<const char *> chunkBounds(const char *data, std::size_t size, int chunks)
+{
+  const char *end = data + size;
+  std::vector<const char *> bounds(chunks + 1, end);
+  bounds[0] = data;
+  for (int c = 1; c < chunks; c++) {
+    const char *p = data + size * std::size_t(c) / std::size_t(chunks);
+    if(p < bounds[c - 1]) p = bounds[c - 1];
+    bounds[c] = p < end ? lineEnd(p, end) : end;
+    if(bounds[c] < end) bounds[c]++;
+  }
+  return bounds;
+}
+
+// Counts the sparse rows in [p, end) and their index:value pairs
+void countSparse(const char *p, const char *end, long long &rows, std::size_t &pairs)
+{
+  rows = 0;
+  pairs = 0;
+  while(p < end){
+    const char *stop = lineEnd(p, end);
+    const char *content = contentEnd(p, stop);
+    if(skipBlanks(p, content) != content){
+      std::size_t rowPairs = 0;
+      int others = 0;
+      countTokens(p, content, rowPairs, others);
+      rows++;
+      pairs += rowPairs;
+    }
+    p = stop + 1;
+  }
+}
+
+// Counts the non-blank lines in [p, end)
+long long countRows(const char *p, const char *end)
+{
+  long long rows = 0;
+  while(p < end){
+    const char *stop = lineEnd(p, end);
+    if(skipBlanks(p, stop) != stop) rows++;
+    p = stop + 1;
+  }
+  return rows;
+}
+
+} // namespace
+
+bool TextLoader::parseHeader(const char *data, std::size_t size, Header &header, std::string &error)
+{
+  const char *end = data + size;
+  const char *p = data ? headerLine(data, end, header.count) : nullptr;
+  if(p) p = headerLine(p, end, header.dimension);
+  if(!p || header.count < 1 || header.dimension < 1){
+    error = "Invalid header, expected the point count and the dimension on the first two lines";
+    return false;
+  }
+  header.size = std::size_t(p - data);
+  return true;
+}
+
+bool TextLoader::parseRows(const char *data, std::size_t size, const Header &header, float *out,
+                           ThreadPool &pool, std::string &error)
+{
+  const int chunks = pool.threadCount() * 4;
+  const std::vector<const char *> bounds = chunkBounds(data, size, chunks);
+
+  //First pass: rows per chunk, so every chunk knows where its rows go
+  std::vector<long long> firstRow(chunks + 1, 0);
+  pool.parallelFor(0, chunks, [&](int begin, int stop, int) {
+    for (int c = begin; c < stop; c++) {
+      firstRow[c + 1] = countRows(bounds[c], bounds[c + 1]);
+    }
+  });
+  for (int c = 0; c < chunks; c++) {
+    firstRow[c + 1] += firstRow[c];
+  }
+  if(firstRow[chunks] < header.count){
+    error = "Expected " + std::to_string(header.count) + " rows, found " + std::to_string(firstRow[chunks]);
+    return false;
+  }
+
+  //Second pass: parse straight into the point buffer
+  const int dimension = header.dimension;
+  std::vector<std::string> errors(chunks);
+  pool.parallelFor(0, chunks, [&](int begin, int stop, int) {
+    for (int c = begin; c < stop; c++) {
+      long long row = firstRow[c];
+      const char *p = bounds[c];
+      const char *chunkEnd = bounds[c + 1];
+      while(p < chunkEnd && row < header.count){
+        const char *rowEnd = lineEnd(p, chunkEnd);
+        const char *q = skipBlanks(p, rowEnd);
+        p = rowEnd + 1;
+        if(q == rowEnd) continue;
+        float *values = out + std::size_t(row) * dimension;
+        int d = 0;
+        for (; d < dimension && q < rowEnd; d++) {
+          std::from_chars_result result = parseFloat(q, rowEnd, values[d]);
+          if(result.ec != std::errc() || (result.ptr < rowEnd && !isBlank(*result.ptr))){
+            errors[c] = "Row " + std::to_string(row + 1) + ": invalid number";
+            return;
+          }
+          q = skipBlanks(result.ptr, rowEnd);
+        }
+        if(d < dimension || q != rowEnd){
+          errors[c] = "Row " + std::to_string(row + 1) + ": expected " + std::to_string(dimension) + " values";
+          return;
+        }
+        row++;
+      }
+    }
+  });
+  for (const std::string &message : errors) {
+    if(!message.empty()){
+      error = message;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TextLoader::isSparse(const char *data, std::size_t size)
+{
+  const char *end = data + size;
+  const char *p = data;
+  while(p < end){
+    const char *stop = lineEnd(p, end);
+    const char *content = contentEnd(p, stop);
+    std::size_t pairs = 0;
+    int others = 0;
+    countTokens(p, content, pairs, others);
+    //Label-only rows and the dense header lines are one token, undecided
+    if(pairs > 0) return true;
+    if(others > 1) return false;
+    p = stop + 1;
+  }
+  return false;
+}
+
+bool TextLoader::parseSparse(const char *data, std::size_t size, SparsePoints &out, ThreadPool &pool, std::string &error)
+{
+  const int chunks = pool.threadCount() * 4;
+  const std::vector<const char *> bounds = chunkBounds(data, size, chunks);
+
+  //First pass: rows and pairs per chunk, so every chunk knows where its entries go
+  std::vector<long long> firstRow(chunks + 1, 0);
+  std::vector<std::size_t> firstPair(chunks + 1, 0);
+  pool.parallelFor(0, chunks, [&](int begin, int stop, int) {
+    for (int c = begin; c < stop; c++) {
+      countSparse(bounds[c], bounds[c + 1], firstRow[c + 1], firstPair[c + 1]);
+    }
+  });
+  for (int c = 0; c < chunks; c++) {
+    firstRow[c + 1] += firstRow[c];
+    firstPair[c + 1] += firstPair[c];
+  }
+  if(firstRow[chunks] == 0 || firstRow[chunks] > std::numeric_limits<int>::max()){
+    error = firstRow[chunks] == 0 ? "No rows found" : "Too many points";
+    return false;
+  }
+
+  //Second pass: parse straight into the CSR arrays
+  const std::size_t rows = std::size_t(firstRow[chunks]);
+  std::vector<std::size_t> offsets(rows + 1, 0);
+  std::vector<int> columns(firstPair[chunks]);
+  std::vector<float> values(firstPair[chunks]);
+  std::vector<int> maxIndex(chunks, 0);
+  std::vector<std::string> errors(chunks);
+  pool.parallelFor(0, chunks, [&](int begin, int stop, int) {
+    for (int c = begin; c < stop; c++) {
+      long long row = firstRow[c];
+      std::size_t pair = firstPair[c];
+      const char *p = bounds[c];
+      const char *chunkEnd = bounds[c + 1];
+      while(p < chunkEnd){
+        const char *newline = lineEnd(p, chunkEnd);
+        const char *rowEnd = contentEnd(p, newline);
+        const char *q = skipBlanks(p, rowEnd);
+        p = newline + 1;
+        if(q == rowEnd) continue;
+        //The target is the one token without a colon
+        const char *token = q;
+        while(token < rowEnd && !isBlank(*token) && *token != ':') token++;
+        if(token == rowEnd || *token != ':'){
+          while(q < rowEnd && !isBlank(*q)) q++;
+          q = skipBlanks(q, rowEnd);
+        }
+        int previous = 0;
+        while(q < rowEnd){
+          const char *stop = tokenEnd(q, rowEnd);
+          if(isQid(q, stop)){
+            q = skipBlanks(stop, rowEnd);
+            continue;
+          }
+          int index = 0;
+          std::from_chars_result result = std::from_chars(q, rowEnd, index);
+          if(result.ec != std::errc() || result.ptr == rowEnd || *result.ptr != ':' || index < 1){
+            errors[c] = "Row " + std::to_string(row + 1) + ": invalid index";
+            return;
+          }
+          if(index <= previous){
+            errors[c] = "Row " + std::to_string(row + 1) + ": indices must be increasing";
+            return;
+          }
+          result = parseFloat(result.ptr + 1, rowEnd, values[pair]);
+          if(result.ec != std::errc() || (result.ptr < rowEnd && !isBlank(*result.ptr))){
+            errors[c] = "Row " + std::to_string(row + 1) + ": invalid number";
+            return;
+          }
+          columns[pair++] = index - 1;
+          previous = index;
+          q = skipBlanks(result.ptr, rowEnd);
+        }
+        maxIndex[c] = std::max(maxIndex[c], previous);
+        offsets[std::size_t(row) + 1] = pair;
+        row++;
+      }
+    }
+  });
+  for (const std::string &message : errors) {
+    if(!message.empty()){
+      error = message;
+      return false;
+    }
+  }
+  const int dimension = *std::max_element(maxIndex.begin(), maxIndex.end());
+  if(dimension < 1){
+    error = "No index:value pairs found";
+    return false;
+  }
+  out.assign(dimension, std::move(offsets), std::move(columns), std::move(values), pool);
+  return true;
+}
@@ -0,0 +1,41 @@
+#ifndef TEXTLOADER_H
+#define TEXTLOADER_H
+
+#include "ThreadPool.h"
+#include <cstddef>
+#include <string>
+
+class SparsePoints;
+
+// Parser for the text point format: the point count and the dimension on
+// the first two lines, then one point per line with whitespace separated
+// values. Rows are split into chunks at line boundaries and parsed in
+// parallel with std::from_chars straight into the preallocated buffer.
+// Sparse points are read from SVMlight / LIBSVM files the same way.
+namespace TextLoader
+{
+  struct Header
+  {
+    int count = 0;
+    int dimension = 0;
+    // Bytes taken by the two header lines
+    std::size_t size = 0;
+  };
+
+  bool parseHeader(const char *data, std::size_t size, Header &header, std::string &error);
+  // Fills out[count * dimension] from the rows following the header. Rows
+  // must have exactly dimension values, blank lines are skipped and rows
+  // past count are ignored.
+  bool parseRows(const char *data, std::size_t size, const Header &header, float *out,
+                 ThreadPool &pool, std::string &error);
+
+  // Whether the first line with an index:value pair comes before any line
+  // of several plain values; single-token lines are passed over
+  bool isSparse(const char *data, std::size_t size);
+  // SVMlight rows: an optional leading target and qid:N (skipped), then
+  // index:value pairs with increasing 1-based indices, '#' starts a comment. The
+  // dimension is the largest index; blank lines are skipped.
+  bool parseSparse(const char *data, std::size_t size, SparsePoints &out, ThreadPool &pool, std::string &error);
+}
+
+#endif // TEXTLOADER_H
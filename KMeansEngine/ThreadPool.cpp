@@ -0,0 +1,103 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threadCount)
+{
+  if(threadCount < 1) threadCount = defaultThreadCount();
+  for (int i = 1; i < threadCount; i++) {
+    m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (std::thread &worker : m_workers) {
+    worker.join();
+  }
+}
+
+int ThreadPool::defaultThreadCount()
+{
+  unsigned count = std::thread::hardware_concurrency();
+  return count == 0 ? 1 : int(count);
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int, int)> &fn)
+{
+  if(end <= begin) return;
+  //Not worth waking the workers for a single chunk
+  if(m_workers.empty() || end - begin < threadCount()){
+    fn(begin, end, 0);
+    return;
+  }
+  dispatch(begin, end, threadCount(), fn);
+}
+
+void ThreadPool::parallelFor(int begin, int end, int chunks, const std::function<void(int, int, int)> &fn)
+{
+  if(end <= begin) return;
+  if(m_workers.empty() || chunks == 1){
+    const long long size = end - begin;
+    for (int chunk = 0; chunk < chunks; chunk++) {
+      int chunkBegin = begin + int(size * chunk / chunks);
+      int chunkEnd = begin + int(size * (chunk + 1) / chunks);
+      if(chunkBegin < chunkEnd) fn(chunkBegin, chunkEnd, chunk);
+    }
+    return;
+  }
+  dispatch(begin, end, chunks, fn);
+}
+
+void ThreadPool::dispatch(int begin, int end, int chunks, const std::function<void(int, int, int)> &fn)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &fn;
+    m_begin = begin;
+    m_end = end;
+    m_chunks = chunks;
+    m_pending = int(m_workers.size());
+    m_generation++;
+  }
+  m_wake.notify_all();
+  runChunk(0);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this]{ return m_pending == 0; });
+  m_task = nullptr;
+}
+
+void ThreadPool::runChunk(int worker)
+{
+  const long long size = m_end - m_begin;
+  const int workers = threadCount();
+  const int firstChunk = int((long long)(m_chunks) * worker / workers);
+  const int lastChunk = int((long long)(m_chunks) * (worker + 1) / workers);
+  for (int chunk = firstChunk; chunk < lastChunk; chunk++) {
+    int chunkBegin = m_begin + int(size * chunk / m_chunks);
+    int chunkEnd = m_begin + int(size * (chunk + 1) / m_chunks);
+    if(chunkBegin < chunkEnd) (*m_task)(chunkBegin, chunkEnd, chunk);
+  }
+}
+
+void ThreadPool::workerLoop(int worker)
+{
+  unsigned seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&]{ return m_quit || m_generation != seen; });
+      if(m_quit) return;
+      seen = m_generation;
+    }
+    runChunk(worker);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending--;
+    }
+    m_done.notify_one();
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads used by the engine kernels. parallelFor()
+// statically splits a range into one contiguous chunk per worker and blocks
+// until all chunks are done; the calling thread works on chunk 0.
+// The overload with a chunk count splits the range the same way whatever
+// the number of threads, for reductions that must not depend on it.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(int threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int threadCount() const { return int(m_workers.size()) + 1; }
+
+  // fn(begin, end, chunk) is called once per non-empty chunk, chunk < threadCount()
+  void parallelFor(int begin, int end, const std::function<void(int, int, int)> &fn);
+  // fn(begin, end, chunk) once per non-empty chunk of chunks equal parts,
+  // each worker runs a contiguous run of chunks
+  void parallelFor(int begin, int end, int chunks, const std::function<void(int, int, int)> &fn);
+
+  static int defaultThreadCount();
+
+private:
+  void workerLoop(int worker);
+  void runChunk(int worker);
+  void dispatch(int begin, int end, int chunks, const std::function<void(int, int, int)> &fn);
+
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+  const std::function<void(int, int, int)> *m_task = nullptr;
+  int m_begin = 0;
+  int m_end = 0;
+  int m_chunks = 0;
+  int m_pending = 0;
+  unsigned m_generation = 0;
+  bool m_quit = false;
+};
+
+#endif // THREADPOOL_H
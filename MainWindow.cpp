@@ -11,9 +11,18 @@ MainWindow::MainWindow(QWidget *parent)
   //Control Panel
   connect(ui->actionShow_Control_Panel, &QAction::triggered, m_controlPanel, &ControlPanel::show);
   connect(m_controlPanel, &ControlPanel::initialCentroids, ui->openGLWidget, &ViewWidget::kmeans_initial);
+  connect(m_controlPanel, &ControlPanel::restarts, ui->openGLWidget, &ViewWidget::setRestarts);
+  connect(m_controlPanel, &ControlPanel::seed, ui->openGLWidget, &ViewWidget::setSeed);
+  connect(m_controlPanel, &ControlPanel::sweepK, ui->openGLWidget, &ViewWidget::kmeans_sweep);
+  connect(m_controlPanel, &ControlPanel::algorithm, ui->openGLWidget, &ViewWidget::setAlgorithm);
+  connect(m_controlPanel, &ControlPanel::batchSize, ui->openGLWidget, &ViewWidget::setBatchSize);
+  connect(m_controlPanel, &ControlPanel::storage, ui->openGLWidget, &ViewWidget::setStorage);
+  connect(m_controlPanel, &ControlPanel::exactRefinement, ui->openGLWidget, &ViewWidget::setExactRefinement);
+  connect(m_controlPanel, &ControlPanel::fullEnergy, ui->openGLWidget, &ViewWidget::kmeans_fullEnergy);
   connect(m_controlPanel, &ControlPanel::step, ui->openGLWidget, &ViewWidget::kmeans_step);
   connect(m_controlPanel, &ControlPanel::stepBack, ui->openGLWidget, &ViewWidget::kmeans_setpBack);
   connect(m_controlPanel, &ControlPanel::runThrough, ui->openGLWidget, &ViewWidget::kmeans_runthrough);
+  connect(ui->openGLWidget, &ViewWidget::runningChanged, m_controlPanel, &ControlPanel::setRunning);
   connect(m_controlPanel, &ControlPanel::pointsShow, ui->openGLWidget, &ViewWidget::setPointsOn);
   connect(m_controlPanel, &ControlPanel::axisShow, ui->openGLWidget, &ViewWidget::setAxisOn);
   connect(m_controlPanel, &ControlPanel::centroidsShow, ui->openGLWidget, &ViewWidget::setCentroidsOn);
@@ -31,6 +40,8 @@ MainWindow::MainWindow(QWidget *parent)
   connect(m_controlPanel, &ControlPanel::randomSampling, ui->openGLWidget, &ViewWidget::generatePoints);
   //Sampling from file
   connect(m_controlPanel, &ControlPanel::loadingFileDir, ui->openGLWidget, &ViewWidget::generatePointsFromFile);
+  connect(m_controlPanel, &ControlPanel::savingFileDir, ui->openGLWidget, &ViewWidget::savePointsToFile);
+  connect(m_controlPanel, &ControlPanel::traceFileDir, ui->openGLWidget, &ViewWidget::saveTrace);
   //Changing point/centroid size
   connect(m_controlPanel, &ControlPanel::pointSize, ui->openGLWidget, &ViewWidget::setPointSize);
   connect(m_controlPanel, &ControlPanel::centroidSize, ui->openGLWidget, &ViewWidget::setCentroidSize);
@@ -1,5 +1,8 @@
 #include "ViewWidget.h"
+#include "Profiler.h"
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <random>
 #include <QOpenGLShaderProgram>
 #include <QtMath>
@@ -7,13 +10,16 @@
 #include <QDebug>
 #include <QtMath>
 #include <QPainter>
-#include <QFile>
-#include <QTextStream>
 #include <QMessageBox>
 
+//qMin binds by reference, so the row length needs a definition
+const int ViewWidget::ColormapRowLength;
 
-ViewWidget::ViewWidget(QWidget *parent, Qt::WindowFlags f) : QOpenGLWidget(parent, f)
+ViewWidget::ViewWidget(QWidget *parent, Qt::WindowFlags f) : QOpenGLWidget(parent, f),
+  m_worker(new ClusterWorker(&m_engine, this))
 {
+  connect(m_worker, &ClusterWorker::progress, this, &ViewWidget::showProgress);
+  connect(m_worker, &QThread::finished, this, &ViewWidget::workerFinished);
   auto turntableTimer = new QTimer(this);
   turntableTimer->callOnTimeout(this, &ViewWidget::updateTurntable);
 
@@ -22,24 +28,34 @@ ViewWidget::ViewWidget(QWidget *parent, Qt::WindowFlags f) : QOpenGLWidget(paren
   m_fpsTimer.start();
 }
 
+//Points carry their cluster label, the color comes from the colormap
+//texture (width x height texels, count entries); labels >= count are white
 static const char *vertexShaderCode_points =
     "attribute highp vec4 vertex;\n"
-    "attribute mediump vec4 color;\n"
-    "varying mediump vec4 vColor;\n"
+    "attribute highp float label;\n"
+    "varying highp float vLabel;\n"
     "uniform highp mat4 matrix;\n"
     "uniform mediump float pSize;\n"
     "void main(void)\n"
     "{\n"
     "   gl_PointSize = pSize;\n"
     "   gl_Position = matrix * vertex;\n"
-    "   vColor = color;\n"
+    "   vLabel = label;\n"
     "}";
 
 static const char *fragmentShaderCode_points =
-    "varying mediump vec4 vColor;\n"
+    "varying highp float vLabel;\n"
+    "uniform sampler2D colormap;\n"
+    "uniform highp vec3 colormapSize;\n"
     "void main(void)\n"
     "{\n"
-    "   gl_FragColor = vColor;\n"
+    "   if(vLabel >= colormapSize.z){\n"
+    "     gl_FragColor = vec4(1.0);\n"
+    "   }else{\n"
+    "     highp float row = floor(vLabel / colormapSize.x);\n"
+    "     highp float column = vLabel - row * colormapSize.x;\n"
+    "     gl_FragColor = texture2D(colormap, vec2((column + 0.5) / colormapSize.x, (row + 0.5) / colormapSize.y));\n"
+    "   }\n"
     "}";
 
 static const char *vertexShaderCode_axis =
@@ -57,6 +73,25 @@ static const char *fragmentShaderCode_axis =
     "   gl_FragColor = color;\n"
     "}";
 
+ViewWidget::~ViewWidget()
+{
+  //The worker and the projection must not outlive the engine they read
+  m_worker->stop();
+  waitProjection();
+  makeCurrent();
+  m_pointVao.destroy();
+  m_centroidVao.destroy();
+  m_axisVao.destroy();
+  m_pointBuffer.destroy();
+  m_labelBuffer.destroy();
+  m_centroidBuffer.destroy();
+  m_centroidLabelBuffer.destroy();
+  m_colormapTexture.destroy();
+  m_axisBuffer.destroy();
+  m_lodIndexBuffer.destroy();
+  doneCurrent();
+}
+
 QVector<GLfloat> ViewWidget::createPolygon(float x, float y, float z, float radius, int sides)
 {
   QVector<GLfloat> result;
@@ -94,23 +129,176 @@ void ViewWidget::initializeGL()
 
  m_pointProgram.link();
 
+ m_axisProgram.addShaderFromSourceCode(QOpenGLShader::Vertex,
+   vertexShaderCode_axis);
+ m_axisProgram.addShaderFromSourceCode(QOpenGLShader::Fragment,
+   fragmentShaderCode_axis);
+ m_axisProgram.link();
+
+ //Buffers live for the whole context, paintGL only refills the dirty ones
+ m_pointBuffer.create();
+ m_labelBuffer.create();
+ m_centroidBuffer.create();
+ m_centroidLabelBuffer.create();
+ m_axisBuffer.create();
+ m_lodIndexBuffer.create();
+ //VAOs are optional (GL 2 / ES 2), without them attributes are set per draw
+ m_pointVao.create();
+ m_centroidVao.create();
+ m_axisVao.create();
+
+ GLfloat axisLength = 500.0;
+ GLfloat const axes[] = {0.0f, 0.0f, 0.0f, axisLength, 0.0f, 0.0f,
+                         0.0f, 0.0f, 0.0f, 0.0f, axisLength, 0.0f,
+                         0.0f, 0.0f, 0.0f, 0.0f, 0.0f, axisLength};
+ m_axisBuffer.bind();
+ m_axisBuffer.allocate(axes, sizeof(axes));
+ m_axisBuffer.release();
+
  // Use QBasicTimer because its faster than QTimer
  timer.start(12, this);
 }
 
+//Copies data into buffer, reallocating only when the size changed
+static void uploadBuffer(QOpenGLBuffer &buffer, const void *data, int bytes)
+{
+  KMEANS_PROFILE_COUNT(BytesUploaded, bytes);
+  buffer.bind();
+  if(buffer.size() == bytes){
+    buffer.write(0, data, bytes);
+  }else{
+    buffer.allocate(data, bytes);
+  }
+  buffer.release();
+}
+
+//Uploads whatever changed since the last frame, called with the context current
+void ViewWidget::uploadBuffers(const float *centroids, int clusterCount)
+{
+  KMEANS_PROFILE_SCOPE(Upload);
+  const bool projected = isProjected();
+  const int tupleSize = projected ? 3 : m_engine.dimension();
+  //Projected data stays dirty until the background projection delivers it
+  if(m_pointsDirty && (!projected || projectionReady())){
+    const float *points = projected ? m_pointsNDVisual.data() : m_engine.points();
+    uploadBuffer(m_pointBuffer, points, m_engine.pointCount() * tupleSize * int(sizeof(float)));
+    uploadLodIndices();
+    m_pointsDirty = false;
+  }
+  if(m_labelsDirty){
+    uploadBuffer(m_labelBuffer, m_labels.constData(), m_labels.size());
+    m_labelsDirty = false;
+  }
+  if(m_centroidsDirty && (!projected || int(m_centroidsNDVisual.size()) == clusterCount * 3)){
+    const float *data = projected ? m_centroidsNDVisual.data() : centroids;
+    uploadBuffer(m_centroidBuffer, data, clusterCount * tupleSize * int(sizeof(float)));
+    m_centroidsDirty = false;
+  }
+  if(m_colormapDirty){
+    uploadColormap();
+    m_colormapDirty = false;
+  }
+  //The vertex layout only changes with the dimension or the label width
+  if(tupleSize != m_tupleSize || m_labelType != m_layoutLabelType){
+    m_tupleSize = tupleSize;
+    m_layoutLabelType = m_labelType;
+    m_pointLayoutSet = false;
+    m_centroidLayoutSet = false;
+  }
+}
+
+//Nested stratified subsample for drawing while the view moves. Stratum r of
+//LodMaxPoints contributes one jittered point, and the strata are listed in
+//bit-reversed order so every power of two prefix covers the whole set evenly.
+void ViewWidget::uploadLodIndices()
+{
+  const int count = m_engine.pointCount();
+  if(count <= LodMaxPoints){
+    m_lodCount = 0;
+    return;
+  }
+  int bits = 0;
+  while((1 << bits) < LodMaxPoints) bits++;
+  const double stratum = double(count) / LodMaxPoints;
+  std::default_random_engine engine(LodMaxPoints);
+  std::uniform_real_distribution<double> jitter(0.0, 1.0);
+  QVector<quint32> indices(LodMaxPoints);
+  for (int j=0; j<LodMaxPoints; j++) {
+    quint32 r = 0;
+    for (int b=0; b<bits; b++) {
+      if(j & (1 << b)) r |= 1u << (bits - 1 - b);
+    }
+    indices[j] = quint32(qMin(double(count - 1), (r + jitter(engine)) * stratum));
+  }
+  uploadBuffer(m_lodIndexBuffer, indices.constData(), LodMaxPoints * int(sizeof(quint32)));
+  m_lodCount = LodMaxPoints;
+  m_lodBudget = qMin(m_lodBudget, m_lodCount);
+}
+
+//Colormap as an RGBA8 texture, wrapped into rows so any K fits; centroid j
+//is drawn with label j so it shares the lookup
+void ViewWidget::uploadColormap()
+{
+  const int count = m_colorMaps.size() / 3;
+  m_colormapCount = count;
+  m_colormapTexture.destroy();
+  if(count == 0) return;
+  const int width = qMin(count, ColormapRowLength);
+  const int height = (count + width - 1) / width;
+  QVector<uchar> texels(width * height * 4, 255);
+  QVector<quint32> centroidLabels(count);
+  for (int i=0; i<count; i++) {
+    for (int c=0; c<3; c++) {
+      texels[i * 4 + c] = uchar(qBound(0.0f, m_colorMaps[i * 3 + c], 1.0f) * 255.0f + 0.5f);
+    }
+    centroidLabels[i] = quint32(i);
+  }
+  m_colormapTexture.create();
+  m_colormapTexture.setFormat(QOpenGLTexture::RGBA8_UNorm);
+  m_colormapTexture.setSize(width, height);
+  m_colormapTexture.allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+  m_colormapTexture.setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, texels.constData());
+  KMEANS_PROFILE_COUNT(BytesUploaded, texels.size());
+  m_colormapTexture.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+  m_colormapTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
+  m_colormapWidth = width;
+  m_colormapHeight = height;
+  uploadBuffer(m_centroidLabelBuffer, centroidLabels.constData(), count * int(sizeof(quint32)));
+}
+
+//Binds the vertex/label layout, recorded once into the VAO when there is one
+void ViewWidget::bindPointAttributes(QOpenGLVertexArrayObject &vao, bool &layoutSet,
+                                     QOpenGLBuffer &vertices, QOpenGLBuffer &labels, GLenum labelType)
+{
+  if(vao.isCreated()){
+    vao.bind();
+    if(layoutSet) return;
+    layoutSet = true;
+  }
+  m_pointProgram.enableAttributeArray("vertex");
+  m_pointProgram.enableAttributeArray("label");
+  vertices.bind();
+  m_pointProgram.setAttributeBuffer("vertex", GL_FLOAT, 0, m_tupleSize);
+  //Unnormalized integers, the shader sees the label value as a float
+  labels.bind();
+  m_pointProgram.setAttributeBuffer("label", labelType, 0, 1);
+  labels.release();
+}
+
+void ViewWidget::releaseAttributes(QOpenGLVertexArrayObject &vao, QOpenGLShaderProgram &program)
+{
+  if(vao.isCreated()){
+    vao.release();
+    return;
+  }
+  program.disableAttributeArray("vertex");
+  program.disableAttributeArray("label");
+}
+
 void ViewWidget::paintGL()
 {
+  KMEANS_PROFILE_SCOPE(Draw);
   glEnable(GL_DEPTH_TEST);
-  QOpenGLShaderProgram program;
-  program.addShaderFromSourceCode(QOpenGLShader::Vertex,
-       vertexShaderCode_axis);
-   program.addShaderFromSourceCode(QOpenGLShader::Fragment,
-       fragmentShaderCode_axis);
-   program.link();
-   program.bind();
-
-   int vertexLocation = program.attributeLocation("vertex");
-   int matrixLocation = program.uniformLocation("matrix");
 
    QMatrix4x4 pmvMatrix;
    //pmvMatrix.ortho(rect());
@@ -127,70 +315,131 @@ void ViewWidget::paintGL()
      pmvMatrix.rotate(m_zRotation, {0.0f, 0.0f, 1.0f});
    }
 
+   //While the worker owns the engine only its published snapshot is read
+   const KMeansEngine::Snapshot *snapshot = m_snapshot.get();
+   const float *centroids = snapshot ? snapshot->centroids.data() : m_engine.centroids();
+   const int clusterCount = snapshot ? snapshot->clusterCount : m_engine.clusterCount();
+   uploadBuffers(centroids, clusterCount);
+
    m_pointProgram.bind();
-   m_pointProgram.enableAttributeArray("vertex");
-   m_pointProgram.enableAttributeArray("color");
    //Draw Datapoints
    m_pointProgram.setUniformValue("pSize", m_pointSize);
    m_pointProgram.setUniformValue("matrix", pmvMatrix);
-   if(m_dimension > 3){
-     m_pointProgram.setAttributeArray("vertex", m_pointsNDVisual.constData(),3);
-   }else{
-     m_pointProgram.setAttributeArray("vertex", m_points.constData(),m_dimension);
+   if(m_colormapTexture.isCreated()) m_colormapTexture.bind(0);
+   m_pointProgram.setUniformValue("colormap", 0);
+   m_pointProgram.setUniformValue("colormapSize", QVector3D(m_colormapWidth, m_colormapHeight,
+                                                            m_colormapTexture.isCreated() ? m_colormapCount : 0));
+   const bool drawable = !isProjected() || projectionReady();
+   if(m_pointsOn && m_engine.pointCount() > 0 && drawable){
+     bindPointAttributes(m_pointVao, m_pointLayoutSet, m_pointBuffer, m_labelBuffer, m_labelType);
+     //Large sets draw a bounded subsample while moving, all points once still
+     const bool lod = m_lodCount > 0 && isInteracting();
+     if(lod){
+       m_lodIndexBuffer.bind();
+       glDrawElements(GL_POINTS, qMin(m_lodBudget, m_lodCount), GL_UNSIGNED_INT, nullptr);
+       m_lodIndexBuffer.release();
+     }else{
+       glDrawArrays(GL_POINTS, 0, m_engine.pointCount());
+     }
+     m_fullFrameDrawn = !lod;
+     releaseAttributes(m_pointVao, m_pointProgram);
    }
-   m_pointProgram.setAttributeArray("color", m_colors.constData(),3);
-   if(m_pointsOn) glDrawArrays(GL_POINTS, 0, m_pointNumber);
    //Draw Centroids
    m_pointProgram.setUniformValue("pSize", m_centroidSize);
-   if(m_dimension>3){
-     m_pointProgram.setAttributeArray("vertex", m_centroidsNDVisual.constData(),3);
-   }else{
-     m_pointProgram.setAttributeArray("vertex", m_centroids.constData(),m_dimension);
+   if(m_centroidsOn && clusterCount > 0 && drawable && !m_centroidsDirty){
+     bindPointAttributes(m_centroidVao, m_centroidLayoutSet, m_centroidBuffer, m_centroidLabelBuffer, GL_UNSIGNED_INT);
+     //A restart may already hold the colormap of its new K while the
+     //snapshot still has the old one, only labelled centroids are drawn
+     glDrawArrays(GL_POINTS, 0, qMin(clusterCount, m_colormapCount));
+     releaseAttributes(m_centroidVao, m_pointProgram);
    }
-   m_pointProgram.setAttributeArray("color", m_colorMaps.constData(),3);
-
-   if(m_centroidsOn) glDrawArrays(GL_POINTS, 0, m_K);
-   m_pointProgram.disableAttributeArray("vertex");
-   m_pointProgram.disableAttributeArray("color");
+   if(m_colormapTexture.isCreated()) m_colormapTexture.release(0);
 
-   program.bind();
-   program.setUniformValue(matrixLocation, pmvMatrix);
-   program.enableAttributeArray(vertexLocation);
+   m_axisProgram.bind();
+   m_axisProgram.setUniformValue("matrix", pmvMatrix);
    GLfloat axisWidth = 1.0;
-   GLfloat axisLength = 500.0;
    glLineWidth(axisWidth);
    if(m_axisOn){
-     GLfloat const xAxis[] = {0.0f, 0.0f, 0.0f,
-                             axisLength, 0.0f,0.0f};
-     program.setAttributeArray(vertexLocation, xAxis, 3);
-     program.setUniformValue("color",QColor(171,171,171,255));
-     glDrawArrays(GL_LINES, 0, 2);
-     GLfloat const yAxis[] = {0.0f, 0.0f, 0.0f,
-                             0.0f, axisLength, 0.0f};
-     program.setAttributeArray(vertexLocation, yAxis, 3);
-     //program.setUniformValue("color",QColor(255,0,255,255));
-     glDrawArrays(GL_LINES, 0, 2);
-     GLfloat const zAxis[] = {0.0f, 0.0f, 0.0f,
-                             0.0f, 0.0f, axisLength};
-     program.setAttributeArray(vertexLocation, zAxis, 3);
-     //program.setUniformValue("color",QColor(255,0,0,255));
-     glDrawArrays(GL_LINES, 0, 2);
+     if(m_axisVao.isCreated()) m_axisVao.bind();
+     if(!m_axisVao.isCreated() || !m_axisLayoutSet){
+       m_axisProgram.enableAttributeArray("vertex");
+       m_axisBuffer.bind();
+       m_axisProgram.setAttributeBuffer("vertex", GL_FLOAT, 0, 3);
+       m_axisBuffer.release();
+       m_axisLayoutSet = m_axisVao.isCreated();
+     }
+     m_axisProgram.setUniformValue("color",QColor(171,171,171,255));
+     glDrawArrays(GL_LINES, 0, 6);
+     if(m_axisVao.isCreated()){
+       m_axisVao.release();
+     }else{
+       m_axisProgram.disableAttributeArray("vertex");
+     }
    }
-
-   program.disableAttributeArray(vertexLocation);
+   m_axisProgram.release();
 
    //Paint useful/interesting information to the screen
    QPainter painter(this);
    painter.setPen(QColor(255,255,255,255));
    painter.drawText(QRect(5, 5, width(), 15), QString::number(m_fps,'G',4)+QString("FPS"));
-   painter.drawText(QRect(5, 20, width(), 15), QString("K: ")+QString::number(m_K,'G',4));
-   painter.drawText(QRect(5, 35, width(), 15), QString("Iteration: ")+QString::number(m_iteration,'G',4));
-   painter.drawText(QRect(5, 50, width(), 15), QString("Energy: ")+QString::number(m_energy,'G',4));
-   painter.drawText(QRect(5, 65, width(), 15), QString("Samples: ")+QString::number(m_pointNumber,'G',4));
+   const int iteration = snapshot ? snapshot->iteration : m_engine.iteration();
+   const float energy = snapshot ? snapshot->energy : m_engine.energy();
+   const float skipped = snapshot ? snapshot->skippedFraction : m_engine.skippedFraction();
+   const float refined = snapshot ? snapshot->refinedFraction : m_engine.refinedFraction();
+   const std::size_t storageBytes = snapshot ? snapshot->storageBytes : m_engine.storageBytes();
+   painter.drawText(QRect(5, 20, width(), 15), QString("K: ")+QString::number(clusterCount,'G',4));
+   painter.drawText(QRect(5, 35, width(), 15), QString("Iteration: ")+QString::number(iteration,'G',4));
+   const bool estimate = m_engine.algorithm() == KMeansEngine::MiniBatch;
+   painter.drawText(QRect(5, 50, width(), 15), QString(estimate ? "Energy (batch est.): " : "Energy: ")+QString::number(energy,'G',4));
+   painter.drawText(QRect(5, 65, width(), 15), QString("Samples: ")+QString::number(m_engine.pointCount(),'G',4));
+   int line = 80;
+   if(m_engine.algorithm() != KMeansEngine::Lloyd){
+     painter.drawText(QRect(5, line, width(), 15), QString("Skipped: ")+QString::number(skipped*100.0f,'f',1)+QString("%"));
+     line += 15;
+   }
+   painter.drawText(QRect(5, line, width(), 15), QString("Iterations/s: ")+QString::number(m_worker->iterationsPerSecond(),'G',4));
+   line += 15;
+   if(m_engine.storage() != KMeansEngine::Float32){
+     QString storage = QString(m_engine.storage() == KMeansEngine::Int8 ? "Int8" : "Float16");
+     if(m_engine.exactRefinement()) storage += QString(", refined: %1%").arg(refined*100.0f,0,'f',1);
+     storage += QString(", %1 MB").arg(storageBytes / 1048576.0,0,'f',1);
+     painter.drawText(QRect(5, line, width(), 15), QString("Storage: ")+storage);
+     line += 15;
+   }
+   if(!m_loadInfo.isEmpty()){
+     painter.drawText(QRect(5, line, width(), 15), m_loadInfo);
+     line += 15;
+   }
+#ifdef KMEANS_PROFILING
+   //Last duration of every phase, then the throughput counters
+   const Profiler &profiler = Profiler::instance();
+   for (int phase=0; phase<Profiler::PhaseCount; phase++) {
+     const Profiler::PhaseStats stats = profiler.phaseStats(Profiler::Phase(phase));
+     painter.drawText(QRect(5, line, width(), 15), QString("%1: %2 ms").arg(Profiler::phaseName(Profiler::Phase(phase)))
+                      .arg(stats.lastMs, 0, 'f', 2));
+     line += 15;
+   }
+   painter.drawText(QRect(5, line, width(), 15), QString("Distance evals/s: ")+QString::number(m_evaluationRate,'G',4));
+   line += 15;
+   painter.drawText(QRect(5, line, width(), 15), QString("Uploaded: %1 MB")
+                    .arg(profiler.count(Profiler::BytesUploaded) / 1e6, 0, 'f', 1));
+#endif
+   drawSweep(painter);
    m_frameCount++;
    if(m_fpsTimer.elapsed() > 500){
-     m_fps = float(m_frameCount)/m_fpsTimer.restart()*1000.0f;
+     const qint64 elapsed = m_fpsTimer.restart();
+     m_fps = float(m_frameCount)/elapsed*1000.0f;
      m_frameCount = 0;
+     //Keep interaction near the timer rate by resizing the subsample
+     if(m_lodCount > 0 && isInteracting()){
+       if(m_fps < 30.0f && m_lodBudget > LodMinPoints) m_lodBudget /= 2;
+       else if(m_fps > 50.0f && m_lodBudget < m_lodCount) m_lodBudget *= 2;
+     }
+#ifdef KMEANS_PROFILING
+     const long long evaluations = Profiler::instance().count(Profiler::DistanceEvaluations);
+     m_evaluationRate = float(evaluations - m_lastEvaluations)/elapsed*1000.0f;
+     m_lastEvaluations = evaluations;
+#endif
    }
 }
 
@@ -198,6 +447,7 @@ void ViewWidget::mousePressEvent(QMouseEvent *e)
 {
   // Save mouse press position
   mousePressPosition = QVector2D(e->localPos());
+  viewChanged(true);
 }
 
 void ViewWidget::mouseReleaseEvent(QMouseEvent *e)
@@ -217,6 +467,7 @@ void ViewWidget::mouseReleaseEvent(QMouseEvent *e)
 
   // Increase angular speed
   angularSpeed += acc;
+  viewChanged(true);
 }
 
 void ViewWidget::timerEvent(QTimerEvent *)
@@ -239,12 +490,10 @@ void ViewWidget::timerEvent(QTimerEvent *)
 QVector<float> ViewWidget::colormapGenerator(int size)
 {
   QVector<float> output;
-  long seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::default_random_engine engine(seed);
   std::uniform_real_distribution<float> distribution(0.0, 1.0);
 
   for(int i=0; i<size*3; i++){
-    output.append(distribution(engine));
+    output.append(distribution(m_colorRandom));
   }
   return output;
 }
@@ -252,7 +501,10 @@ QVector<float> ViewWidget::colormapGenerator(int size)
 void ViewWidget::updateTurntable()
 {
   //m_turntableAngle += 1.0f;
-
+  collectProjection();
+  //Large still views are drawn in full once instead of every tick
+  const bool dirty = m_pointsDirty || m_labelsDirty || m_centroidsDirty || m_colormapDirty;
+  if(m_lodCount > 0 && m_fullFrameDrawn && !dirty && !isInteracting() && !m_worker->isRunning()) return;
   update();
 }
 
@@ -263,266 +515,399 @@ void ViewWidget::generatePoints(int dimension, int sampleNumber)
     return;
   }
   clearPoints();
-  m_dimension = dimension;
-  m_pointNumber = sampleNumber;
-  // Create random 3D points
-  // Get seed from clock
-  long seed = std::chrono::system_clock::now().time_since_epoch().count();
-
-  // Seed engine and set random distribution to [-1, 1]
-  std::default_random_engine engine(seed);
-  std::uniform_real_distribution<float> distribution(-3.0, 3.0);
-
-  // Create points inside a sphere
-  int count = 0;
-  while(count < m_pointNumber)
-  {
-    // Uniformly sample cube
-    for (int i=0; i<m_dimension; i++) {
-      float x = distribution(engine);
-      m_points.append({x});
-    }
-    count++;
-  }
-  m_colors = QVector<float>(m_pointNumber * 3, 1.0f);
-  if(m_dimension>3) calculatePointsNDVisual();
+  // Uniformly sample the cube [-3, 3]^dimension
+  m_engine.generatePoints(dimension, sampleNumber, -3.0f, 3.0f);
+  m_loadInfo.clear();
+  resetLabels(0);
+  if(dimension>3) calculatePointsNDVisual();
+  m_pointsDirty = true;
 }
 
 void ViewWidget::generatePointsFromFile(QString dir)
 {
-  QFile file(dir);
-
-  if(!file.open(QFile::ReadOnly | QFile::Text)){
-    QMessageBox::warning(this,"title","File openning failed!");
+  clearPoints();
+  std::string error;
+  if(!m_engine.loadFile(dir.toStdString(), error)){
+    m_pointsDirty = true;
+    QMessageBox::warning(this,"title",QString("File loading failed!\n")+QString::fromStdString(error));
     return;
   }
-  clearPoints();
-  QTextStream in(&file);
-  QString text = in.readLine();
-  m_pointNumber = text.toInt();
-  text = in.readLine();
-  m_dimension = text.toInt();
-  QVector<float> temp;
-  while(!in.atEnd()){
-    text = in.readLine();
-    for (int i = 0; i < m_dimension; i++) {
-      temp.append(text.split(" ")[i].toFloat());
-    }
+  const KMeansEngine::LoadStats &stats = m_engine.loadStats();
+  const double megabytes = stats.bytes / 1e6;
+  m_loadInfo = QString("Loaded: %1 MB in %2 s (%3 MB/s)").arg(megabytes, 0, 'f', 1).arg(stats.seconds, 0, 'f', 2)
+      .arg(stats.seconds > 0 ? megabytes / stats.seconds : 0.0, 0, 'f', 0);
+  if(m_engine.isSparse()){
+    const SparsePoints &sparse = *m_engine.sparsePoints();
+    m_loadInfo += QString(", sparse: %1 nonzeros in %2 MB").arg(qulonglong(sparse.nonZeros()))
+        .arg(sparse.bytes() / 1e6, 0, 'f', 1);
+  }
+  resetLabels(0);
+  if(isProjected()) calculatePointsNDVisual();
+  m_pointsDirty = true;
+}
+
+void ViewWidget::savePointsToFile(QString dir)
+{
+  std::string error;
+  if(!m_engine.saveBinaryFile(dir.toStdString(), error)){
+    QMessageBox::warning(this,"title",QString("File saving failed!\n")+QString::fromStdString(error));
+  }
+}
+
+void ViewWidget::saveTrace(QString dir)
+{
+  std::string error;
+  if(!Profiler::instance().writeChromeTrace(dir.toStdString(), error)){
+    QMessageBox::warning(this,"title",QString("Trace export failed!\n")+QString::fromStdString(error));
   }
-  m_points = temp;
-  m_colors = QVector<float>(m_pointNumber * 3, 1.0f);
-  file.close();
-  if(m_dimension>3) calculatePointsNDVisual();
 }
 
 void ViewWidget::kmeans_step()
 {
-  if(m_centroids.size()<2){
+  if(!m_engine.isInitialized()){
     QMessageBox::warning(this,"title","Please initialize centroids first");
     return;
   }
-  // Seed engine and set random distribution to [-1, 1]
-  long seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::default_random_engine engine(seed);
-  std::uniform_real_distribution<float> distribution(-1.0, 1.0);
-  m_centroids_history_history = m_centroids_history;
-  m_centroids_history = m_centroids;
-  //clustering part
-  //distance calculation and clusering
-  for (int i = 0 ; i < m_pointNumber; i++) {
-    float min = 999999.9f;
-    for (int j = 0; j < m_K; j++) {
-      float distance = euclideanDistance(j, i);
-      if(distance < min){
-        min = distance;
-        m_class[i]=j;
-        mapColor(i,j);
-      }else if(distance == min){
-        //Equal distance 50% chance change class
-        if (distribution(engine)>0){
-          m_class[i]=j;
-          mapColor(i,j);
-        }
-      }
-    }
-  }
-  //Update new centroid
-  for (int i = 0; i< m_K; i++) {
-    QVector<float> coor = QVector<float>(m_dimension, 0.0f);
-    int count = 0;
-    for (int j = 0; j<m_pointNumber; j++) {
-      if(m_class[j]==i){
-        for (int k=0; k<m_dimension; k++) {
-          coor[k] += m_points[ j * m_dimension + k];
-        }
-        count++;
-      }
-    }
-    updateCentroids(coor, count, i);
+  if(m_worker->isRunning()) return;
+  //After stepping back the next iterations are replayed from the history
+  if(m_engine.stepForward()){
+    syncFromEngine();
+    return;
   }
-  m_energy = energyCalculation();
-  m_iteration += 1;
-  if(m_dimension>3) calculateCentroidsNDVisual();
+  m_runningThrough = false;
+  m_worker->startSteps(1, INT_MAX);
+  m_snapshot = m_worker->snapshot();
 }
 
 void ViewWidget::kmeans_setpBack()
 {
-  if(m_centroids.size()<2){
+  stopWorker();
+  if(!m_engine.isInitialized()){
     QMessageBox::warning(this,"title","Please initialize centroids first");
     return;
   }
-  if(m_centroids_history.size()==0){
-    QMessageBox::warning(this,"title","You already stepped back!");
+  if(!m_engine.stepBack()){
+    QMessageBox::warning(this,"title","No earlier iteration in history!");
     return;
   }
-  if(m_iteration<2||m_centroids_history_history.size()==0){
-    QMessageBox::warning(this,"title","Too early to setp back!");
+  if(m_engine.iteration()==0){
+    showSeeds();
+    if(isProjected()) calculateCentroidsNDVisual();
+    m_centroidsDirty = true;
     return;
   }
-  m_centroids = m_centroids_history_history;
-  m_centroids_history.clear();
-  kmeans_step();
-  m_iteration -= 2;
+  syncFromEngine();
 }
 
 void ViewWidget::kmeans_runthrough()
 {
-  if(m_centroids.size()<2){
+  //Run doubles as Stop while the worker is busy, restarts and sweeps included
+  if(m_worker->isRunning()){
+    stopWorker();
+    syncFromEngine();
+    return;
+  }
+  if(!m_engine.isInitialized()){
     QMessageBox::warning(this,"title","Please initialize centroids first");
     return;
   }
-  bool dirty = true;
-  while(dirty && m_iteration<1000){
-    float energy_old = m_energy;
-    kmeans_step();
-    if(energy_old==m_energy) dirty = false;
+  m_runningThrough = true;
+  m_worker->startSteps(0, 1000);
+  m_snapshot = m_worker->snapshot();
+  emit runningChanged(true);
+}
+
+//Latest published iteration, queued from the worker thread
+void ViewWidget::showProgress()
+{
+  if(!m_worker->isRunning()) return;
+  m_snapshot = m_worker->snapshot();
+  //A sweep leaves the clustering alone, and before any Init it has no labels
+  if(m_sweeping) return;
+  updateColors(m_snapshot->labels, m_snapshot->clusterCount);
+  if(isProjected()) calculateCentroidsNDVisual(m_snapshot->centroids.data(), m_snapshot->clusterCount);
+  m_centroidsDirty = true;
+  update();
+}
+
+void ViewWidget::workerFinished()
+{
+  //finished is queued, a stopped run's signal can arrive after the next start
+  if(m_worker->isRunning()) return;
+  emit runningChanged(false);
+  //Cancelled runs were already synced by whoever stopped them
+  const bool restarting = m_restarting;
+  const bool sweeping = m_sweeping;
+  m_restarting = false;
+  m_sweeping = false;
+  if(m_worker->wasCancelled()) return;
+  if(sweeping){
+    //The sweep does not touch the clustering, only the curve is new
+    m_snapshot.reset();
+    if(!m_worker->converged()) return;
+    m_sweepResults = m_engine.sweepResults();
+    update();
+    QMessageBox::information(this,"title",QString("Swept K = %1..%2 in %3 s")
+                             .arg(m_sweepResults.front().k).arg(m_sweepResults.back().k)
+                             .arg(m_sweepTimer.elapsed() / 1000.0,0,'f',2));
+    return;
   }
-  if(!dirty){
+  if(restarting){
+    syncFromEngine();
+    const std::vector<float> &energies = m_engine.restartStats().energies;
+    double mean = 0.0;
+    for (float energy : energies) mean += energy;
+    mean /= energies.size();
+    QMessageBox::information(this,"title",QString("Best of %1 restarts: %2\nMin / mean / max energy: %3 / %4 / %5")
+                             .arg(energies.size()).arg(m_engine.energy(),0,'G',6)
+                             .arg(*std::min_element(energies.begin(), energies.end()),0,'G',6).arg(mean,0,'G',6)
+                             .arg(*std::max_element(energies.begin(), energies.end()),0,'G',6));
+    return;
+  }
+  //Mini-batch only labels the sampled points, label everything once at the end
+  if(m_runningThrough && m_engine.algorithm() == KMeansEngine::MiniBatch) m_engine.fullEnergy();
+  syncFromEngine();
+  if(!m_runningThrough) return;
+  if(m_worker->converged()){
     QMessageBox::warning(this,"title","Clustered!");
   }else{
     QMessageBox::warning(this,"title","Reach to End!");
   }
 }
 
+void ViewWidget::stopWorker()
+{
+  m_worker->stop();
+  m_snapshot.reset();
+}
+
+//Back to rendering straight from the idle engine
+void ViewWidget::syncFromEngine()
+{
+  m_snapshot.reset();
+  updateColors();
+  if(isProjected()) calculateCentroidsNDVisual();
+  m_centroidsDirty = true;
+}
+
+void ViewWidget::kmeans_fullEnergy()
+{
+  stopWorker();
+  if(!m_engine.isInitialized()){
+    QMessageBox::warning(this,"title","Please initialize centroids first");
+    return;
+  }
+  float energy = m_engine.fullEnergy();
+  syncFromEngine();
+  QMessageBox::information(this,"title",QString("Full Energy: ")+QString::number(energy,'G',6));
+}
+
 void ViewWidget::kmeans_initial(int k, int mode)
 {
-  if (k<2||k>m_pointNumber){
+  stopWorker();
+  if(m_restarts > 1){
+    if(k<2 || k>m_engine.pointCount()){
+      QMessageBox::warning(this,"title","Invalid K number");
+      return;
+    }
+    //Trials run to convergence on the worker, the best one is shown at the end
+    resetLabels(k);
+    m_colorMaps = colormapGenerator(k);
+    m_colormapDirty = true;
+    m_runningThrough = false;
+    m_restarting = true;
+    m_worker->startRestarts(k, mode, m_restarts, 1000);
+    m_snapshot = m_worker->snapshot();
+    emit runningChanged(true);
+    return;
+  }
+  if(!m_engine.initialize(k, mode)){
     QMessageBox::warning(this,"title","Invalid K number");
     return;
   }
-  m_K = k;
-  //Initialization
-  // Seed engine and set random distribution to [-1, 1]
-  long seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::default_random_engine engine(seed);
-  std::uniform_real_distribution<float> distribution(-20.0, 20.0);
-  //clear m parameters in case multiple initialization
-  m_centroids.clear();
-  m_centroids_history.clear();
-  m_class = QVector<int>(m_pointNumber,0);
-  m_colors = QVector<float>(m_pointNumber * 3, 1.0f);
-  m_colorMaps = colormapGenerator(m_K);
-  //Random real
-  if(mode == 0){
-    qDebug()<<"random real value";
-    for (int i=0; i<m_dimension * m_K; i++){
-      float x = distribution(engine);
-      m_centroids.append(x);
-    }
-  }else if(mode == 1){    //random sample
-    qDebug()<<"random sample";
-    for (int i=0; i<m_K; i++){
-      int x = (distribution(engine)+20) / 40 * m_pointNumber;
-      mapColor(x, i);
-      x = x * m_dimension;
-      for (int j=0; j<m_dimension; j++) {
-        m_centroids.append(m_points.at(x+j));
-      }
-    }
-  }else{    //K-Means++
-    //Randomly select 1 sample first
-    int x = (distribution(engine)+20) / 40 * m_pointNumber;
-    mapColor(x, 0);
-    x = x * m_dimension;
-    for (int j=0; j<m_dimension; j++) {
-      m_centroids.append(m_points.at(x+j));
-    }
-    // find the farthest sample
-    for (int i = 0; i < m_K-1 ; ++i ) {
-      float max = -1;
-      int index = 0;
-      for ( int j = 0; j < m_pointNumber; j++){
-        float distance = 0;
-        for (int k = 0; k < i+1; k++){
-          distance += euclideanDistance(k, j);
-          }
-        if( distance > max ){
-          max = distance;
-          index = j;
-        }
-      }
-      mapColor(index, i+1);
-      //qDebug()<<"new centroids index"<<index;
-      for (int j=0; j<m_dimension; j++) {
-        m_centroids.append(m_points.at(index * m_dimension+j));
-      }
-    }
+  m_colorMaps = colormapGenerator(k);
+  showSeeds();
+  if(isProjected()) calculateCentroidsNDVisual();
+  m_centroidsDirty = true;
+  m_colormapDirty = true;
+}
+
+void ViewWidget::kmeans_sweep(int first, int last, int mode)
+{
+  stopWorker();
+  if(first<2 || first>last || last>m_engine.pointCount()){
+    QMessageBox::warning(this,"title","Invalid K range");
+    return;
+  }
+  //Every K runs to convergence on the worker, the curve is drawn at the end
+  m_runningThrough = false;
+  m_sweeping = true;
+  m_sweepTimer.start();
+  m_worker->startSweep(first, last, mode, 1000);
+  m_snapshot = m_worker->snapshot();
+  emit runningChanged(true);
+}
+
+//Energy vs K of the last sweep in the bottom right corner, look for the elbow
+void ViewWidget::drawSweep(QPainter &painter)
+{
+  if(m_sweepResults.size() < 2) return;
+  const QRect box(width()-215, height()-165, 200, 150);
+  float low = m_sweepResults.front().energy;
+  float high = low;
+  for (const KMeansEngine::SweepResult &result : m_sweepResults) {
+    low = qMin(low, result.energy);
+    high = qMax(high, result.energy);
+  }
+  const float range = qMax(high - low, 1e-6f);
+  const int first = m_sweepResults.front().k;
+  const int span = m_sweepResults.back().k - first;
+  QPolygonF curve;
+  for (const KMeansEngine::SweepResult &result : m_sweepResults) {
+    curve << QPointF(box.left() + double(result.k - first) / span * box.width(),
+                     box.bottom() - (result.energy - low) / range * box.height());
+  }
+  painter.setPen(QColor(171,171,171,255));
+  painter.drawRect(box);
+  painter.drawText(QRect(box.left(), box.top()-15, box.width(), 15),
+                   QString("Energy vs K (%1-%2)").arg(first).arg(m_sweepResults.back().k));
+  painter.setPen(QColor(255,255,255,255));
+  painter.drawPolyline(curve);
+  for (const QPointF &point : curve) painter.drawEllipse(point, 2.0, 2.0);
+}
+
+void ViewWidget::setRestarts(int count)
+{
+  m_restarts = qMax(1, count);
+}
+
+//Restarts the random streams, the next points, seeds and colors repeat
+//for the same seed
+void ViewWidget::setSeed(int seed)
+{
+  stopWorker();
+  m_engine.setSeed(quint64(seed));
+  m_colorRandom.seed(quint64(seed), ColormapStream);
+}
+
+void ViewWidget::setAlgorithm(int algorithm)
+{
+  stopWorker();
+  m_engine.setAlgorithm(algorithm);
+}
+
+void ViewWidget::setBatchSize(int size)
+{
+  stopWorker();
+  m_engine.setBatchSize(size);
+}
+
+void ViewWidget::setStorage(int storage)
+{
+  stopWorker();
+  m_engine.setStorage(storage);
+}
+
+void ViewWidget::setExactRefinement(bool on)
+{
+  stopWorker();
+  m_engine.setExactRefinement(on);
+}
+
+//Before the first step only the seed points are colored
+void ViewWidget::showSeeds()
+{
+  resetLabels(m_engine.clusterCount());
+  const std::vector<int> &seeds = m_engine.seedIndices();
+  for (int i=0; i<int(seeds.size()); i++) {
+    mapColor(seeds[i], i);
   }
-  m_iteration = 0;
-  if(m_dimension>3) calculateCentroidsNDVisual();
 }
 
-float ViewWidget::euclideanDistance(int centroid_index, int point_index)
+template<typename T>
+static void fillLabels(QByteArray &out, const int *labels, int count)
 {
-  float distance = 0.0f;
-  for (int i=0; i<m_dimension; i++) {
-    distance += qPow((m_centroids.at(centroid_index * m_dimension + i)-m_points.at(point_index * m_dimension + i)), 2);
+  T *data = reinterpret_cast<T *>(out.data());
+  for (int i=0; i<count; i++) {
+    data[i] = T(labels[i]);
   }
-  return qSqrt(distance);
+}
+
+//16-bit labels unless K needs more, every point starts unlabeled (white)
+void ViewWidget::resetLabels(int k)
+{
+  const bool wide = k >= 0xFFFF;
+  m_labelType = wide ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  m_labels.fill(char(0xFF), m_engine.pointCount() * (wide ? 4 : 2));
+  m_labelsDirty = true;
 }
 
 void ViewWidget::mapColor(int point_index, int colormap_index)
 {
-  for (int i=0; i<3; i++) {
-    m_colors[point_index * 3 + i] = m_colorMaps[colormap_index * 3 + i];
+  if(m_labelType == GL_UNSIGNED_INT){
+    reinterpret_cast<quint32 *>(m_labels.data())[point_index] = quint32(colormap_index);
+  }else{
+    reinterpret_cast<quint16 *>(m_labels.data())[point_index] = quint16(colormap_index);
   }
+  m_labelsDirty = true;
 }
 
-void ViewWidget::updateCentroids(QVector<float> coor, int count, int centroid_index)
+//Recolor every point from its current cluster label
+void ViewWidget::updateColors()
 {
-  bool dirty = false;
-  for (int i=0; i<m_dimension; i++) {
-    if(coor[i]/count != m_centroids[centroid_index * m_dimension + i]){
-      m_centroids[centroid_index * m_dimension + i] = coor[i]/count;
-      dirty = true;
-    }
+  //Before Init the engine has no labels yet
+  if(!m_engine.isInitialized()) return;
+  updateColors(m_engine.labels(), m_engine.clusterCount());
+}
+
+//Snapshot labels, ignored unless there is one per point
+void ViewWidget::updateColors(const std::vector<int> &labels, int clusterCount)
+{
+  if(int(labels.size()) != m_engine.pointCount()) return;
+  updateColors(labels.data(), clusterCount);
+}
+
+//Restarts and sweeps can publish a different K than the labels were sized
+//for, the label width follows the K the labels came with
+void ViewWidget::updateColors(const int *labels, int clusterCount)
+{
+  if((clusterCount >= 0xFFFF) != (m_labelType == GL_UNSIGNED_INT)) resetLabels(clusterCount);
+  if(m_labelType == GL_UNSIGNED_INT){
+    fillLabels<quint32>(m_labels, labels, m_engine.pointCount());
+  }else{
+    fillLabels<quint16>(m_labels, labels, m_engine.pointCount());
   }
-  dirty ? m_dirty = true : m_dirty = false;
+  m_labelsDirty = true;
 }
 
 void ViewWidget::setMovieOn(bool checked)
 {
   m_movieOn = checked;
+  viewChanged(true);
 }
 
 void ViewWidget::setPointsOn(bool checked)
 {
   m_pointsOn = checked;
+  viewChanged(false);
 }
 
 void ViewWidget::setAxisOn(bool checked)
 {
   m_axisOn = checked;
+  viewChanged(false);
 }
 
 void ViewWidget::setFreeView(bool checked)
 {
   m_freeView = checked;
+  viewChanged(true);
 }
 
 void ViewWidget::setCentroidsOn(bool checked)
 {
   m_centroidsOn = checked;
+  viewChanged(false);
 }
 
 float rotationNorm(int angle){
@@ -532,82 +917,149 @@ float rotationNorm(int angle){
 void ViewWidget::setXRotation(int angle)
 {
   m_xRotation = rotationNorm(angle);
+  viewChanged(true);
 }
 
 void ViewWidget::setYRotation(int angle)
 {
   m_yRotation = rotationNorm(angle);
+  viewChanged(true);
 }
 
 void ViewWidget::setZRotation(int angle)
 {
   m_zRotation = rotationNorm(angle);
+  viewChanged(true);
 }
 
 void ViewWidget::setZooming(int zoomLevel)
 {
   m_zooming = (float)zoomLevel/180;
+  viewChanged(true);
 }
 //Clear history points
 void ViewWidget::clearPoints()
 {
-  m_points.clear();
-  m_centroids.clear();
-  m_centroids_history.clear();
-  m_centroids_history_history.clear();
-  m_iteration = 0;
+  stopWorker();
+  waitProjection();
+  m_projection.reset();
+  m_pointsNDVisual.clear();
+  m_centroidsNDVisual.clear();
+  m_sweepResults.clear();
+  m_engine.clear();
+  m_pointsDirty = true;
+  m_centroidsDirty = true;
 }
 
+//Fits a PCA projection and projects every point on a background thread,
+//collectProjection() picks the result up once it is done
 void ViewWidget::calculatePointsNDVisual()
 {
+  waitProjection();
+  m_projection.reset();
   m_pointsNDVisual.clear();
-  for (int i=0; i<m_pointNumber; i++) {
-    for(int j=0; j<3; j++){
-      m_pointsNDVisual.append(m_points[i * m_dimension + j]);
+  m_centroidsNDVisual.clear();
+  const float *points = m_engine.points();
+  std::shared_ptr<const SparsePoints> sparse = m_engine.sparsePoints();
+  const int count = m_engine.pointCount();
+  const int dimension = m_engine.dimension();
+  m_projectionTask = std::async(std::launch::async, [points, sparse, count, dimension]() {
+    ProjectedPoints result;
+    result.projection = std::make_shared<Projection>();
+    result.points.resize(std::size_t(count) * 3);
+    if(sparse){
+      result.projection->fit(*sparse, Projection::PrincipalComponents);
+      result.projection->project(*sparse, result.points.data());
     }
-  }
+    else{
+      result.projection->fit(points, count, dimension, Projection::PrincipalComponents);
+      result.projection->project(points, count, result.points.data());
+    }
+    return result;
+  });
+}
+
+//Sparse points have no dense rows to draw, they are projected at any D
+bool ViewWidget::isProjected() const
+{
+  return m_engine.dimension() > 3 || m_engine.isSparse();
+}
+
+bool ViewWidget::projectionReady() const
+{
+  return m_projection && int(m_pointsNDVisual.size()) == m_engine.pointCount() * 3;
+}
+
+void ViewWidget::collectProjection()
+{
+  if(!m_projectionTask.valid() || m_projectionTask.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+  ProjectedPoints result = m_projectionTask.get();
+  m_projection = result.projection;
+  m_pointsNDVisual.swap(result.points);
+  m_pointsDirty = true;
+  //Centroids may have moved while the points were being projected
+  if(m_snapshot) calculateCentroidsNDVisual(m_snapshot->centroids.data(), m_snapshot->clusterCount);
+  else calculateCentroidsNDVisual();
+  m_centroidsDirty = true;
+}
+
+//The task reads the engine's points, they must outlive it
+void ViewWidget::waitProjection()
+{
+  if(m_projectionTask.valid()) m_projectionTask.wait();
+  m_projectionTask = std::future<ProjectedPoints>();
 }
 
 void ViewWidget::calculateCentroidsNDVisual()
 {
-  m_centroidsNDVisual.clear();
-  for (int i=0; i<m_K; i++){
-    for (int j=0; j<3; j++){
-      m_centroidsNDVisual.append(m_centroids[i * m_dimension + j]);
-    }
-  }
+  calculateCentroidsNDVisual(m_engine.centroids(), m_engine.clusterCount());
 }
 
-float ViewWidget::energyCalculation()
+//Only the centroids are re-projected per iteration, with the cached matrix;
+//the count comes with the centroids since the engine may be busy on the worker
+void ViewWidget::calculateCentroidsNDVisual(const float *centroids, int clusterCount)
 {
-  float energy = 0;
-  for(int i=0; i<m_pointNumber; i++){
-    energy += euclideanDistance(m_class[i], i);
+  if(!m_projection || clusterCount == 0){
+    m_centroidsNDVisual.clear();
+    return;
   }
-  return energy;
+  m_centroidsNDVisual.resize(std::size_t(clusterCount) * 3);
+  m_projection->project(centroids, clusterCount, m_centroidsNDVisual.data());
 }
 
 void ViewWidget::setPointSize(float size)
 {
   m_pointSize = size;
+  viewChanged(false);
 }
 
 void ViewWidget::setCentroidSize(float size)
 {
   m_centroidSize = size;
+  viewChanged(false);
 }
 
 void ViewWidget::setPanningX(float d)
 {
   x_panning = d;
+  viewChanged(true);
 }
 
 void ViewWidget::setPanningY(float d)
 {
   y_panning = d;
+  viewChanged(true);
 }
 
+//Moving the camera switches to the subsample for a short while, any change
+//needs a new full frame afterwards
+void ViewWidget::viewChanged(bool interactive)
+{
+  if(interactive) m_interactionTimer.start();
+  m_fullFrameDrawn = false;
+}
 
-
-
-
+bool ViewWidget::isInteracting() const
+{
+  return m_movieOn || angularSpeed > 0.0 || (m_interactionTimer.isValid() && m_interactionTimer.elapsed() < LodSettleMs);
+}
@@ -4,16 +4,28 @@
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLTexture>
 #include <QElapsedTimer>
 #include <QMouseEvent>
 #include <QBasicTimer>
+#include <future>
+#include <memory>
+#include <vector>
+#include "ClusterWorker.h"
+#include "KMeansEngine.h"
+#include "Projection.h"
+
+class QPainter;
 
 class ViewWidget : public QOpenGLWidget, protected QOpenGLFunctions
 {
-  //Q_OBJECT
+  Q_OBJECT
 
 public:
   ViewWidget(QWidget *parent = nullptr, Qt::WindowFlags f = Qt::WindowFlags());
+  ~ViewWidget();
   QVector<GLfloat> createPolygon(float x, float y, float z, float radius, int sides);
 
   float angleForTime(qint64 msTime, float secondsPerRotation) const;
@@ -27,13 +39,26 @@ public slots:
   void updateTurntable();
   void generatePoints(int dimension, int sampleNumber);
   void generatePointsFromFile(QString dir);
+  void savePointsToFile(QString dir);
+  void saveTrace(QString dir);
   void kmeans_initial(int k, int mode);
+  void setRestarts(int count);
+  void setSeed(int seed);
+  void kmeans_sweep(int first, int last, int mode);
+  void setAlgorithm(int algorithm);
+  void setBatchSize(int size);
+  void setStorage(int storage);
+  void setExactRefinement(bool on);
   void kmeans_step();
   void kmeans_setpBack();
   void kmeans_runthrough();
-  float euclideanDistance(int centroid_index, int point_index);
+  void kmeans_fullEnergy();
+  void showProgress();
+  void workerFinished();
   void mapColor(int point_index, int colormap_index);
-  void updateCentroids(QVector<float> coor, int count, int centroid_index);
+  void updateColors();
+  void updateColors(const int *labels, int clusterCount);
+  void updateColors(const std::vector<int> &labels, int clusterCount);
   void setMovieOn(bool checked);
   void setPointsOn(bool checked);
   void setAxisOn(bool checked);
@@ -46,35 +71,109 @@ public slots:
   void clearPoints();
   void calculatePointsNDVisual();
   void calculateCentroidsNDVisual();
-  float energyCalculation();
+  void calculateCentroidsNDVisual(const float *centroids, int clusterCount);
   void setPointSize(float size);
   void setCentroidSize(float size);
   void setPanningX(float d);
   void setPanningY(float d);
+signals:
+  //Run-through, restarts and sweeps started or ended, single steps do not count
+  void runningChanged(bool running);
 private:
   QVector<float> colormapGenerator(int size);
+  void stopWorker();
+  void syncFromEngine();
+  void showSeeds();
+  void drawSweep(QPainter &painter);
+  void resetLabels(int k);
+  bool isProjected() const;
+  bool projectionReady() const;
+  void collectProjection();
+  void waitProjection();
+  void uploadBuffers(const float *centroids, int clusterCount);
+  void uploadColormap();
+  void uploadLodIndices();
+  void viewChanged(bool interactive);
+  bool isInteracting() const;
+  void bindPointAttributes(QOpenGLVertexArrayObject &vao, bool &layoutSet,
+                           QOpenGLBuffer &vertices, QOpenGLBuffer &labels, GLenum labelType);
+  void releaseAttributes(QOpenGLVertexArrayObject &vao, QOpenGLShaderProgram &program);
   QElapsedTimer m_elapsedTimer;
   QElapsedTimer m_fpsTimer;
   int m_frameCount = 0;
   float m_fps;
-  int m_K = 0;
+  //Distance evaluations per second, refreshed with the FPS
+  long long m_lastEvaluations = 0;
+  float m_evaluationRate = 0.0f;
   float m_turntableAngle = 0.0f;
-  int m_dimension = 3;
-  int m_pointNumber = 0;
-  int m_iteration = 0;
-  float m_energy = 0.0;
-  bool m_dirty = true;
-  QVector<float> m_points;
-  QVector<float> m_colors;
+  KMeansEngine m_engine;
+  //Clustering thread and the last state it published, null when idle
+  ClusterWorker *m_worker;
+  std::shared_ptr<const KMeansEngine::Snapshot> m_snapshot;
+  bool m_runningThrough = false;
+  //n_init: initialize runs this many full trials and keeps the best one
+  int m_restarts = 1;
+  bool m_restarting = false;
+  //Energy vs K of the last finished sweep, drawn in the overlay
+  bool m_sweeping = false;
+  QElapsedTimer m_sweepTimer;
+  std::vector<KMeansEngine::SweepResult> m_sweepResults;
+  //Size and throughput of the last file load for the overlay
+  QString m_loadInfo;
+  //Per-point colormap index (quint16 or quint32), all ones means unlabeled
+  QByteArray m_labels;
+  GLenum m_labelType = GL_UNSIGNED_SHORT;
   QVector<float> m_centroidsColor;
   QVector<float> m_colorMaps;
-  QVector<float> m_centroids;
-  QVector<float> m_centroids_history;
-  QVector<float> m_centroids_history_history;
-  QVector<int> m_class;
-  QVector<float> m_pointsNDVisual;
-  QVector<float> m_centroidsNDVisual;
+  //Colormaps follow the engine seed on a stream of their own
+  static const unsigned ColormapStream = 1000;
+  CounterRng m_colorRandom{0, ColormapStream};
+  //D > 3 and sparse points are drawn through a PCA projection fitted off
+  //the GUI thread
+  struct ProjectedPoints
+  {
+    std::shared_ptr<Projection> projection;
+    std::vector<float> points;
+  };
+  std::future<ProjectedPoints> m_projectionTask;
+  std::shared_ptr<Projection> m_projection;
+  std::vector<float> m_pointsNDVisual;
+  std::vector<float> m_centroidsNDVisual;
   QOpenGLShaderProgram m_pointProgram;
+  QOpenGLShaderProgram m_axisProgram;
+  //GPU copies of the render data, re-uploaded only when flagged dirty
+  QOpenGLBuffer m_pointBuffer;
+  QOpenGLBuffer m_labelBuffer;
+  QOpenGLBuffer m_centroidBuffer;
+  QOpenGLBuffer m_centroidLabelBuffer;
+  QOpenGLTexture m_colormapTexture{QOpenGLTexture::Target2D};
+  static const int ColormapRowLength = 1024;
+  int m_colormapWidth = 1;
+  int m_colormapHeight = 1;
+  int m_colormapCount = 0;
+  QOpenGLBuffer m_axisBuffer;
+  //Level of detail: above LodMaxPoints points only the first m_lodBudget
+  //indices of a stratified subsample are drawn while the view moves
+  static const int LodMaxPoints = 1 << 21;
+  static const int LodMinPoints = 1 << 16;
+  static const int LodSettleMs = 300;
+  QOpenGLBuffer m_lodIndexBuffer{QOpenGLBuffer::IndexBuffer};
+  int m_lodCount = 0;
+  int m_lodBudget = 1 << 20;
+  QElapsedTimer m_interactionTimer;
+  bool m_fullFrameDrawn = false;
+  QOpenGLVertexArrayObject m_pointVao;
+  QOpenGLVertexArrayObject m_centroidVao;
+  QOpenGLVertexArrayObject m_axisVao;
+  bool m_pointsDirty = true;
+  bool m_labelsDirty = true;
+  bool m_centroidsDirty = true;
+  bool m_colormapDirty = true;
+  int m_tupleSize = 0;
+  GLenum m_layoutLabelType = 0;
+  bool m_pointLayoutSet = false;
+  bool m_centroidLayoutSet = false;
+  bool m_axisLayoutSet = false;
 
   bool m_pointsOn = true;
   bool m_centroidsOn = true;